@@ -4,6 +4,10 @@
 #include "debug.h"
 #endif
 
+#if CONFIG_MEMORY_POOL_EXPORT
+#include "export.h"
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -16,6 +20,10 @@ static void exit_function(void)
     printf("malloc free count: %d\n", memory_pool_debug_malloc_free_count());
 #endif
 
+#if CONFIG_MEMORY_POOL_EXPORT
+    memory_pool_export_json_file(stdout);
+#endif
+
     printf("exit function run end\n");
 }
 
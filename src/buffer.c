@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "buffer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "malloc.h"
+
+#ifndef MEM_BUF_SLICE_NUM
+#define MEM_BUF_SLICE_NUM (256)  /* slice descriptors, multiple of 64 */
+#endif
+
+#if (MEM_BUF_SLICE_NUM == 0) || (MEM_BUF_SLICE_NUM % 64)
+#error "MEM_BUF_SLICE_NUM error"
+#endif
+
+/* slice descriptors, a set bit marks one in use */
+static mem_buf_t        slice_desc[MEM_BUF_SLICE_NUM];
+static _Atomic uint64_t slice_used[MEM_BUF_SLICE_NUM / 64];
+
+static mem_buf_t* slice_desc_get(void)
+{
+    for (uint32_t word = 0; word < (MEM_BUF_SLICE_NUM / 64); word++) {
+        uint64_t bits = atomic_load_explicit(&slice_used[word],
+                                             memory_order_relaxed);
+        while (bits != UINT64_MAX) {
+            uint32_t bit = 0;
+            while (bits & (1ull << bit)) {
+                bit++;
+            }
+
+            if (atomic_compare_exchange_weak_explicit(
+                    &slice_used[word], &bits, bits | (1ull << bit),
+                    memory_order_acquire, memory_order_relaxed)) {
+                return &slice_desc[word * 64 + bit];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static bool slice_desc_put(mem_buf_t* buf)
+{
+    uintptr_t offset = (uintptr_t)buf - (uintptr_t)slice_desc;
+    if (offset >= sizeof(slice_desc)) {
+        return false;
+    }
+
+    uint32_t index = offset / sizeof(mem_buf_t);
+
+    atomic_fetch_and_explicit(&slice_used[index / 64],
+                              ~(1ull << (index % 64)), memory_order_release);
+    return true;
+}
+
+mem_buf_t* mem_buf_alloc(uint8_t memx, uint32_t size, char* file_name,
+                         uint32_t func_line)
+{
+    if (size > (UINT32_MAX - sizeof(mem_buf_t))) {
+        return NULL;
+    }
+
+    mem_buf_t* buf = mymalloc(memx, sizeof(mem_buf_t) + size, file_name,
+                              func_line);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    buf->data      = (uint8_t*)(buf + 1);
+    buf->len       = size;
+    buf->parent    = NULL;
+    buf->file_name = file_name;
+    buf->func_line = func_line;
+    buf->memx      = memx;
+    atomic_init(&buf->refs, 1);
+
+    return buf;
+}
+
+mem_buf_t* mem_buf_retain(mem_buf_t* buf)
+{
+    if (buf) {
+        atomic_fetch_add_explicit(&buf->refs, 1, memory_order_relaxed);
+    }
+
+    return buf;
+}
+
+void mem_buf_release(mem_buf_t* buf)
+{
+    while (buf) {
+        /* the last owner must see every write made through other refs */
+        if (atomic_fetch_sub_explicit(&buf->refs, 1, memory_order_acq_rel)
+            != 1) {
+            return;
+        }
+
+        mem_buf_t* parent = buf->parent;
+        if (!slice_desc_put(buf)) {
+            myfree(buf, buf->file_name, buf->func_line);
+        }
+        buf = parent;
+    }
+}
+
+mem_buf_t* mem_buf_slice(mem_buf_t* buf, uint32_t offset, uint32_t len)
+{
+    if ((buf == NULL) || (offset > buf->len) || (len > (buf->len - offset))) {
+        return NULL;
+    }
+
+    /* slices of slices share the block owner directly */
+    mem_buf_t* owner = buf->parent ? buf->parent : buf;
+
+    /* a bank block only once the descriptors ran out */
+    mem_buf_t* slice = slice_desc_get();
+    if (slice == NULL) {
+        slice = mymalloc(owner->memx, sizeof(mem_buf_t), owner->file_name,
+                         owner->func_line);
+        if (slice == NULL) {
+            return NULL;
+        }
+    }
+
+    slice->data      = buf->data + offset;
+    slice->len       = len;
+    slice->parent    = mem_buf_retain(owner);
+    slice->file_name = owner->file_name;
+    slice->func_line = owner->func_line;
+    slice->memx      = owner->memx;
+    atomic_init(&slice->refs, 1);
+
+    return slice;
+}
+
+uint32_t mem_buf_refs(mem_buf_t* buf)
+{
+    return buf ? atomic_load_explicit(&buf->refs, memory_order_relaxed) : 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Reference-counted buffer living in a pool block, the header with the
+ * count sits right in front of the payload, so a buffer takes
+ * sizeof(mem_buf_t) more bytes of its bank than the payload. A slice is a
+ * descriptor that shares a sub-range of the payload and holds a reference
+ * on the buffer owning the block, which goes back to its bank on the last
+ * release. Descriptors come from a static lock-free set of
+ * MEM_BUF_SLICE_NUM, once they are all taken a slice costs a block of the
+ * owner's bank under its lock, attributed to the original call site by
+ * the debug tracer, and fails if that bank is full.
+ */
+typedef struct mem_buf {
+    _Alignas(8) uint8_t* data;      /* payload, 8 aligned behind the header */
+    uint32_t             len;       /* payload bytes */
+    _Atomic uint32_t     refs;
+    struct mem_buf*      parent;    /* buffer owning the block, NULL if self */
+    char*                file_name; /* original allocation site */
+    uint32_t             func_line;
+    uint8_t              memx;
+} mem_buf_t;
+
+#define MEM_BUF_ALLOC(memx, size) \
+    mem_buf_alloc((memx), (size), __FILE__, __LINE__)
+
+/* allocate a buffer of size bytes with one reference, NULL on failure */
+mem_buf_t* mem_buf_alloc(uint8_t memx, uint32_t size, char* file_name,
+                         uint32_t func_line);
+
+/* take one more reference, return buf */
+mem_buf_t* mem_buf_retain(mem_buf_t* buf);
+
+/* drop one reference, the last one frees the buffer */
+void mem_buf_release(mem_buf_t* buf);
+
+/* new buffer with one reference sharing len bytes at offset of buf,
+ * NULL if the range is out of buf, or all MEM_BUF_SLICE_NUM descriptors are
+ * taken and the bank of buf is full
+ */
+mem_buf_t* mem_buf_slice(mem_buf_t* buf, uint32_t offset, uint32_t len);
+
+uint32_t mem_buf_refs(mem_buf_t* buf);
+
+#endif /* _BUFFER_H_ */
@@ -130,7 +130,7 @@ static char* get_filename(const char* path)
 #else
     return NULL;
 #endif
-    return ptr + 1;
+    return ptr ? (ptr + 1) : (char*)path;
 }
 
 void memory_pool_debug_init(void)
@@ -336,9 +336,138 @@ int32_t memory_pool_debug_malloc_free_count(void)
     return count;
 }
 
+void memory_pool_debug_stat(memory_pool_debug_stat_t* stat)
+{
+    if (stat == NULL) {
+        return;
+    }
+
+    memset((void*)stat, 0, sizeof(memory_pool_debug_stat_t));
+
+    debug_mutex_lock();
+
+    stat->malloc_free_cnt = tracer_list.malloc_free_cnt;
+    stat->used_node_cnt   = tracer_list.used_node.count;
+    stat->unused_node_cnt = tracer_list.unused_node.count;
+    stat->flag            = tracer_list.flag;
+    stat->refree_cnt      = tracer_list.refree_statistic.count;
+
+    tracer_node_t* p_node = tracer_list.used_node.p_next;
+    while (p_node) {
+        if (p_node->memx < SRAMBANK) {
+            stat->mem_statistic[p_node->memx] += p_node->mem_sz;
+        }
+        p_node = p_node->p_next;
+    }
+
+    debug_mutex_unlock();
+}
+
+/* walk a node list, return its length or 0xffff if it has a foreign node,
+ * loops or its tail is wrong
+ */
+static uint16_t check_node_list(const tracer_node_data_t* p_node_data)
+{
+    uint16_t             count  = 0;
+    const tracer_node_t* p_last = NULL;
+
+    for (const tracer_node_t* p_node = p_node_data->p_next; p_node;
+         p_node = p_node->p_next) {
+        if ((p_node < tracer_node)
+            || (p_node >= (tracer_node + TRACER_NODE_NUM))
+            || (count == TRACER_NODE_NUM)) {
+            return 0xffff;
+        }
+        p_last = p_node;
+        count++;
+    }
+
+    if ((p_last != p_node_data->p_tail) || (count != p_node_data->count)) {
+        return 0xffff;
+    }
+
+    return count;
+}
+
+bool memory_pool_debug_check(void)
+{
+    debug_mutex_lock();
+
+    uint16_t used   = check_node_list(&tracer_list.used_node);
+    uint16_t unused = check_node_list(&tracer_list.unused_node);
+
+    debug_mutex_unlock();
+
+    return (used != 0xffff) && (unused != 0xffff)
+           && ((used + unused) == TRACER_NODE_NUM);
+}
+
+/* a node of the same site comes earlier in the used list */
+static bool find_site_before(const tracer_node_t* p_node)
+{
+    tracer_node_t* p_prev = tracer_list.used_node.p_next;
+    for (; p_prev != p_node; p_prev = p_prev->p_next) {
+        if ((p_prev->file_name == p_node->file_name)
+            && (p_prev->func_line == p_node->func_line)
+            && (p_prev->memx == p_node->memx)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint16_t memory_pool_debug_site(memory_pool_debug_site_t* sites,
+                                uint16_t max_sites)
+{
+    uint16_t count = 0;
+    uint16_t total = 0;
+
+    if ((sites == NULL) || (max_sites == 0)) {
+        return 0;
+    }
+
+    debug_mutex_lock();
+
+    tracer_node_t* p_node = tracer_list.used_node.p_next;
+    while (p_node) {
+        uint16_t i = 0;
+        while (i < count) {
+            if ((sites[i].file_name == p_node->file_name)
+                && (sites[i].func_line == p_node->func_line)
+                && (sites[i].memx == p_node->memx)) {
+                sites[i].count++;
+                sites[i].mem_sz += p_node->mem_sz;
+                break;
+            }
+            i++;
+        }
+
+        if ((i == count) && (count < max_sites)) {
+            sites[count].file_name = p_node->file_name;
+            sites[count].func_line = p_node->func_line;
+            sites[count].memx      = p_node->memx;
+            sites[count].count     = 1;
+            sites[count].mem_sz    = p_node->mem_sz;
+            count++;
+            total++;
+        } else if ((i == count) && !find_site_before(p_node)) {
+            /* sites is full, only count a site seen for the first time */
+            total++;
+        }
+
+        p_node = p_node->p_next;
+    }
+
+    debug_mutex_unlock();
+    return total;
+}
+
 void memory_pool_debug_trace(void)
 {
-    uint8_t print_buf[1024] = { 0 };
+    uint32_t mem_statistic[TRACER_MEMX_NUM];
+    repeat_statistic_t repeat_statistic[TRACER_REPEAT_NUM];
+    refree_statistic_t refree_statistic;
 
     debug_mutex_lock();
 
@@ -382,6 +511,13 @@ void memory_pool_debug_trace(void)
         p_node = p_node->p_next;
     }
 
+    memcpy((void*)mem_statistic, (void*)tracer_list.mem_statistic,
+           sizeof(mem_statistic));
+    memcpy((void*)repeat_statistic, (void*)tracer_list.repeat_statistic,
+           sizeof(repeat_statistic));
+    memcpy((void*)&refree_statistic, (void*)&tracer_list.refree_statistic,
+           sizeof(refree_statistic_t));
+
     debug_mutex_unlock();
 
     printf("tracer_list.malloc_free_cnt = %d\n", malloc_free_cnt);
@@ -389,69 +525,46 @@ void memory_pool_debug_trace(void)
     printf("tracer_list.used   node cnt = %u\n", used_node_cnt);
     printf("tracer_list.flag            = 0x%02x\n", flag);
 
-    printf("SRAMIN  : %u\n", tracer_list.mem_statistic[0]);
-    printf("SRAMEX  : %u\n", tracer_list.mem_statistic[1]);
-    printf("SRAMCCM : %u\n", tracer_list.mem_statistic[2]);
-    printf("SRAMEX1 : %u\n", tracer_list.mem_statistic[3]);
-    printf("SRAMEX2 : %u\n", tracer_list.mem_statistic[4]);
+    for (uint8_t memx = 0; memx < TRACER_MEMX_NUM; memx++) {
+        printf("%-8s: %u\n", mem_name(memx), mem_statistic[memx]);
+    }
 
-    uint8_t* p_buf = print_buf;
-    p_buf += sprintf((char*)p_buf, "malloc : ");
+    /* print directly instead of building lines in a fixed buffer, since
+     * a long call-site list could overflow it
+     */
+    printf("malloc : ");
     for (uint16_t i = 0, j = 0; i < TRACER_REPEAT_NUM; i++) {
-        if (tracer_list.repeat_statistic[i].count) {
-            j++;
-            p_buf += sprintf((char*)p_buf, "%s(%u) = %u\t",
-                             tracer_list.repeat_statistic[i].pos_info.file_name,
-                             tracer_list.repeat_statistic[i].pos_info.func_line,
-                             tracer_list.repeat_statistic[i].count);
+        if (repeat_statistic[i].count == 0) {
+            continue;
         }
 
         if (j == 4) {
             j = 0;
-            p_buf = print_buf;
-            printf("%s", p_buf);
-            p_buf += sprintf((char*)p_buf, "malloc : ");
-        } else {
-            if ((i == (TRACER_REPEAT_NUM - 1)) && j) {
-                j = 0;
-                p_buf = print_buf;
-                printf("%s", p_buf);
-                p_buf += sprintf((char*)p_buf, "malloc : ");
-            }
+            printf("\nmalloc : ");
         }
-    }
+        j++;
 
+        printf("%s(%u) = %u\t",
+               repeat_statistic[i].pos_info.file_name,
+               repeat_statistic[i].pos_info.func_line,
+               repeat_statistic[i].count);
+    }
     printf("\n");
 
-    if (tracer_list.refree_statistic.count) {
-        printf("refree total count: %u\n", tracer_list.refree_statistic.count);
+    if (refree_statistic.count) {
+        printf("refree total count: %u\n", refree_statistic.count);
     }
 
-    memset(print_buf, 0, sizeof(print_buf));
-    p_buf = print_buf;
-    p_buf += sprintf((char*)p_buf, "refree: ");
-    for (uint16_t i = 0, j = 0; i < TRACER_REFREE_NUM; i++) {
-        if (tracer_list.refree_statistic.pos_info[i].file_name) {
-            j++;
-            p_buf
-                += sprintf((char*)p_buf, "%s(%u)\t",
-                           tracer_list.refree_statistic.pos_info[i].file_name,
-                           tracer_list.refree_statistic.pos_info[i].func_line);
-        }
-
+    printf("refree: ");
+    for (uint16_t i = 0, j = 0; i < refree_statistic.count; i++) {
         if (j == 4) {
             j = 0;
-            p_buf = print_buf;
-            printf("%s", p_buf);
-            p_buf += sprintf((char*)p_buf, "refree: ");
-        } else {
-            if ((i == (TRACER_REFREE_NUM - 1)) && j) {
-                j = 0;
-                p_buf = print_buf;
-                printf("%s", p_buf);
-                p_buf += sprintf((char*)p_buf, "refree: ");
-            }
+            printf("\nrefree: ");
         }
+        j++;
+
+        printf("%s(%u)\t", refree_statistic.pos_info[i].file_name,
+               refree_statistic.pos_info[i].func_line);
     }
     printf("\n");
 }
@@ -21,6 +21,25 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "malloc.h"
+
+typedef struct {
+    int32_t  malloc_free_cnt;
+    uint16_t used_node_cnt;
+    uint16_t unused_node_cnt;
+    uint16_t flag;
+    uint16_t refree_cnt;
+    uint32_t mem_statistic[SRAMBANK];  /* bytes in use per bank */
+} memory_pool_debug_stat_t;
+
+typedef struct {
+    char*    file_name;
+    uint32_t func_line;
+    uint8_t  memx;
+    uint16_t count;
+    uint32_t mem_sz;
+} memory_pool_debug_site_t;
+
 void memory_pool_debug_init(void);
 
 bool memory_pool_debug_add(uint8_t memx, uint32_t mem_sz, void* malloc_ptr,
@@ -31,6 +50,20 @@ bool memory_pool_debug_del(void* malloc_ptr, char* file_name,
 
 int32_t memory_pool_debug_malloc_free_count(void);
 
+void memory_pool_debug_stat(memory_pool_debug_stat_t* stat);
+
+/* aggregate live allocations per call site and bank, at most max_sites
+ * entries are stored, return the total number of distinct sites, which
+ * is larger than max_sites when some were left out
+ */
+uint16_t memory_pool_debug_site(memory_pool_debug_site_t* sites,
+                                uint16_t max_sites);
+
+/* check the tracer lists: no loops or foreign nodes, counts and tails
+ * match and every node is either used or unused
+ */
+bool memory_pool_debug_check(void);
+
 void memory_pool_debug_trace(void);
 
 #endif /* _DEBUG_H_ */
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "export.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "malloc.h"
+
+#if CONFIG_MEMORY_POOL_DEBUG
+#include "debug.h"
+#endif
+
+#ifndef EXPORT_RUN_NUM
+#define EXPORT_RUN_NUM  (256)
+#endif
+
+#ifndef EXPORT_SITE_NUM
+#define EXPORT_SITE_NUM (64)
+#endif
+
+typedef struct {
+    char*  buf;
+    size_t len;
+    size_t pos;
+    FILE*  fp;
+    bool   error;
+} export_writer_t;
+
+static void export_printf(export_writer_t* w, const char* fmt, ...)
+{
+    va_list ap;
+    int     n;
+
+    va_start(ap, fmt);
+    if (w->fp) {
+        n = vfprintf(w->fp, fmt, ap);
+    } else {
+        size_t left = (w->pos < w->len) ? (w->len - w->pos) : 0;
+        n = vsnprintf(left ? (w->buf + w->pos) : NULL, left, fmt, ap);
+    }
+    va_end(ap);
+
+    if (n < 0) {
+        w->error = true;
+        return;
+    }
+
+    w->pos += n;
+}
+
+static void export_string(export_writer_t* w, const char* str)
+{
+    export_printf(w, "\"");
+    for (; str && *str; str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            export_printf(w, "\\%c", *str);
+        } else if ((uint8_t)*str < 0x20) {
+            export_printf(w, "\\u%04x", (uint8_t)*str);
+        } else {
+            export_printf(w, "%c", *str);
+        }
+    }
+    export_printf(w, "\"");
+}
+
+_Static_assert(MEM_BACKING_MMAP == 0x10, "export_backing names are stale");
+
+/* MEM_BACKING_xxx flags by name, an empty list is the static array */
+static void export_backing(export_writer_t* w, uint8_t backing)
+{
+    /* in bit order of MEM_BACKING_xxx */
+    static const char* const name[] = { "hugetlb", "thp", "populate", "lock",
+                                        "mmap" };
+
+    bool first = true;
+    export_printf(w, "[");
+    for (uint8_t bit = 0; bit < (sizeof(name) / sizeof(name[0])); bit++) {
+        if (backing & (1u << bit)) {
+            export_printf(w, "%s\"%s\"", first ? "" : ",", name[bit]);
+            first = false;
+        }
+    }
+    export_printf(w, "]");
+}
+
+static int export_finish(export_writer_t* w)
+{
+    if (w->error) {
+        return -1;
+    }
+
+    if (w->fp == NULL) {
+        if (w->len) {
+            w->buf[(w->pos < w->len) ? w->pos : (w->len - 1)] = '\0';
+        }
+    }
+
+    return (int)w->pos;
+}
+
+#if CONFIG_MEMORY_POOL_DEBUG
+static void export_label(export_writer_t* w, const char* str)
+{
+    for (; str && *str; str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            export_printf(w, "\\%c", *str);
+        } else if (*str == '\n') {
+            export_printf(w, "\\n");
+        } else {
+            export_printf(w, "%c", *str);
+        }
+    }
+}
+
+static void export_json_site(export_writer_t* w,
+                             const memory_pool_debug_site_t* sites,
+                             uint16_t site_cnt, uint8_t memx)
+{
+    bool first = true;
+    for (uint16_t i = 0; i < site_cnt; i++) {
+        if (sites[i].memx != memx) {
+            continue;
+        }
+
+        export_printf(w, "%s{\"file\":", first ? "" : ",");
+        export_string(w, sites[i].file_name);
+        export_printf(w, ",\"line\":%u,\"count\":%u,\"bytes\":%u}",
+                      sites[i].func_line, sites[i].count, sites[i].mem_sz);
+        first = false;
+    }
+}
+
+static void export_prometheus_site(export_writer_t* w, const char* metric,
+                                   const memory_pool_debug_site_t* site,
+                                   uint32_t value)
+{
+    export_printf(w, "%s{bank=\"%s\",file=\"", metric, mem_name(site->memx));
+    export_label(w, site->file_name);
+    export_printf(w, "\",line=\"%u\"} %u\n", site->func_line, value);
+}
+#endif
+
+static void export_json(export_writer_t* w)
+{
+    uint32_t runs[EXPORT_RUN_NUM];
+
+#if CONFIG_MEMORY_POOL_DEBUG
+    memory_pool_debug_site_t sites[EXPORT_SITE_NUM];
+    memory_pool_debug_stat_t stat;
+
+    memory_pool_debug_stat(&stat);
+    uint16_t site_total = memory_pool_debug_site(sites, EXPORT_SITE_NUM);
+    uint16_t site_cnt   = (site_total > EXPORT_SITE_NUM) ? EXPORT_SITE_NUM
+                                                         : site_total;
+#endif
+
+    export_printf(w, "{\"banks\":[");
+
+    bool first = true;
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        mem_info_t info;
+        if (!mem_snapshot(memx, &info, runs, EXPORT_RUN_NUM)) {
+            continue;
+        }
+
+        export_printf(w, "%s{\"id\":%u,\"name\":", first ? "" : ",", memx);
+        first = false;
+        export_string(w, info.name);
+        export_printf(w, ",\"ready\":%s,\"policy\":%u,\"backing\":",
+                      info.ready ? "true" : "false", info.policy);
+        export_backing(w, info.backing);
+        export_printf(w,
+                      ",\"pool_size\":%u,\"block_size\":%u,\"blocks\":%u,"
+                      "\"used_blocks\":%u,\"usage\":%u,\"free_runs\":%u,"
+                      "\"largest_free_run\":%u,",
+                      info.pool_size, info.block_size, info.block_count,
+                      info.used_blocks,
+                      info.block_count
+                          ? ((info.used_blocks * 100) / info.block_count)
+                          : 0,
+                      info.free_runs, info.largest_free_run);
+
+        /* compact run-length heap map, e.g. "12U3188F" */
+        export_printf(w, "\"heapmap\":\"");
+        for (uint32_t i = 0; (i < info.run_count) && (i < EXPORT_RUN_NUM);
+             i++) {
+            export_printf(w, "%u%c", MEM_RUN_LEN(runs[i]),
+                          (runs[i] & MEM_RUN_USED) ? 'U' : 'F');
+        }
+        export_printf(w, "\",\"heapmap_truncated\":%s",
+                      (info.run_count > EXPORT_RUN_NUM) ? "true" : "false");
+
+#if CONFIG_MEMORY_POOL_DEBUG
+        /* the site list is shared, any bank may have lost sites */
+        export_printf(w, ",\"callsites_truncated\":%s,\"callsites\":[",
+                      (site_total > EXPORT_SITE_NUM) ? "true" : "false");
+        export_json_site(w, sites, site_cnt, memx);
+#else
+        export_printf(w, ",\"callsites_truncated\":false,\"callsites\":[");
+#endif
+        export_printf(w, "]}");
+    }
+
+    export_printf(w, "]");
+
+#if CONFIG_MEMORY_POOL_DEBUG
+    export_printf(w,
+                  ",\"debug\":{\"malloc_free_cnt\":%d,\"used_nodes\":%u,"
+                  "\"unused_nodes\":%u,\"flag\":%u,\"refree_cnt\":%u}",
+                  stat.malloc_free_cnt, stat.used_node_cnt,
+                  stat.unused_node_cnt, stat.flag, stat.refree_cnt);
+#endif
+
+    export_printf(w, "}\n");
+}
+
+/* banks whose snapshot failed are left out */
+static void export_prometheus_gauge(export_writer_t* w, const mem_info_t* info,
+                                    const bool* valid, const char* metric,
+                                    const char* help, size_t field)
+{
+    export_printf(w, "# HELP %s %s\n# TYPE %s gauge\n", metric, help, metric);
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        if (!valid[memx]) {
+            continue;
+        }
+        export_printf(w, "%s{bank=\"%s\"} %u\n", metric, info[memx].name,
+                      *(const uint32_t*)((const uint8_t*)&info[memx] + field));
+    }
+}
+
+static void export_prometheus(export_writer_t* w)
+{
+    mem_info_t info[SRAMBANK];
+    bool       valid[SRAMBANK];
+
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        valid[memx] = mem_snapshot(memx, &info[memx], NULL, 0);
+    }
+
+    export_prometheus_gauge(w, info, valid, "mempool_pool_bytes",
+                            "Bank pool size in bytes.",
+                            offsetof(mem_info_t, pool_size));
+    export_prometheus_gauge(w, info, valid, "mempool_block_bytes",
+                            "Bank block size in bytes.",
+                            offsetof(mem_info_t, block_size));
+    export_prometheus_gauge(w, info, valid, "mempool_blocks",
+                            "Bank block count.",
+                            offsetof(mem_info_t, block_count));
+    export_prometheus_gauge(w, info, valid, "mempool_used_blocks",
+                            "Bank blocks currently allocated.",
+                            offsetof(mem_info_t, used_blocks));
+    export_prometheus_gauge(w, info, valid, "mempool_free_runs",
+                            "Bank contiguous free runs.",
+                            offsetof(mem_info_t, free_runs));
+    export_prometheus_gauge(w, info, valid, "mempool_largest_free_run_blocks",
+                            "Bank largest contiguous free run in blocks.",
+                            offsetof(mem_info_t, largest_free_run));
+
+#if CONFIG_MEMORY_POOL_DEBUG
+    memory_pool_debug_site_t sites[EXPORT_SITE_NUM];
+    memory_pool_debug_stat_t stat;
+
+    memory_pool_debug_stat(&stat);
+    uint16_t site_cnt = memory_pool_debug_site(sites, EXPORT_SITE_NUM);
+    site_cnt = (site_cnt > EXPORT_SITE_NUM) ? EXPORT_SITE_NUM : site_cnt;
+
+    export_printf(w, "# HELP mempool_used_bytes Bank bytes requested by "
+                     "live allocations.\n"
+                     "# TYPE mempool_used_bytes gauge\n");
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        if (!valid[memx]) {
+            continue;
+        }
+        export_printf(w, "mempool_used_bytes{bank=\"%s\"} %u\n",
+                      info[memx].name, stat.mem_statistic[memx]);
+    }
+
+    export_printf(w, "# HELP mempool_callsite_allocations Live allocations "
+                     "per call site.\n"
+                     "# TYPE mempool_callsite_allocations gauge\n");
+    for (uint16_t i = 0; i < site_cnt; i++) {
+        export_prometheus_site(w, "mempool_callsite_allocations", &sites[i],
+                               sites[i].count);
+    }
+
+    export_printf(w, "# HELP mempool_callsite_bytes Live bytes per call "
+                     "site.\n"
+                     "# TYPE mempool_callsite_bytes gauge\n");
+    for (uint16_t i = 0; i < site_cnt; i++) {
+        export_prometheus_site(w, "mempool_callsite_bytes", &sites[i],
+                               sites[i].mem_sz);
+    }
+
+    export_printf(w, "# HELP mempool_malloc_free_count Outstanding malloc "
+                     "minus free calls.\n"
+                     "# TYPE mempool_malloc_free_count gauge\n"
+                     "mempool_malloc_free_count %d\n",
+                  stat.malloc_free_cnt);
+    export_printf(w, "# HELP mempool_refree_total Recorded double frees.\n"
+                     "# TYPE mempool_refree_total counter\n"
+                     "mempool_refree_total %u\n",
+                  stat.refree_cnt);
+#endif
+}
+
+int memory_pool_export_json(char* buf, size_t len)
+{
+    export_writer_t w = { buf, len, 0, NULL, false };
+    if ((buf == NULL) && len) {
+        return -1;
+    }
+
+    export_json(&w);
+    return export_finish(&w);
+}
+
+int memory_pool_export_json_file(FILE* fp)
+{
+    export_writer_t w = { NULL, 0, 0, fp, false };
+    if (fp == NULL) {
+        return -1;
+    }
+
+    export_json(&w);
+    return export_finish(&w);
+}
+
+int memory_pool_export_prometheus(char* buf, size_t len)
+{
+    export_writer_t w = { buf, len, 0, NULL, false };
+    if ((buf == NULL) && len) {
+        return -1;
+    }
+
+    export_prometheus(&w);
+    return export_finish(&w);
+}
+
+int memory_pool_export_prometheus_file(FILE* fp)
+{
+    export_writer_t w = { NULL, 0, 0, fp, false };
+    if (fp == NULL) {
+        return -1;
+    }
+
+    export_prometheus(&w);
+    return export_finish(&w);
+}
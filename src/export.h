@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Export every bank's occupancy, run-length heap map and call-site
+ * statistics (when CONFIG_MEMORY_POOL_DEBUG is enabled).
+ *
+ * The buffer variants follow snprintf semantics: the output is always
+ * NUL terminated and the return value is the length the full output
+ * needs, so a return value >= len means it was truncated. The FILE*
+ * variants return the number of characters written, or -1 on error.
+ *
+ * Each bank is locked only while its table is copied out, serialization
+ * runs unlocked, so it is safe to call periodically from a scraper.
+ *
+ * The JSON "backing" of a bank lists the MEM_BACKING_xxx flags the pool
+ * really got by name: "hugetlb", "thp", "populate", "lock" and "mmap", an
+ * empty list is the static array.
+ */
+int memory_pool_export_json(char* buf, size_t len);
+
+int memory_pool_export_json_file(FILE* fp);
+
+int memory_pool_export_prometheus(char* buf, size_t len);
+
+int memory_pool_export_prometheus_file(FILE* fp);
+
+#endif /* _EXPORT_H_ */
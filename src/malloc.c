@@ -17,73 +17,263 @@
 
 #include "malloc.h"
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 
 #if __linux__
 #include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #endif
 
 #if CONFIG_MEMORY_POOL_DEBUG
 #include "debug.h"
 #endif
 
+#if CONFIG_MEMORY_POOL_TRACE
+#include "trace.h"
+#endif
+
+#if CONFIG_MEMORY_POOL_MMAP
+#if !__linux__
+#error "CONFIG_MEMORY_POOL_MMAP needs mmap"
+#endif
+#include <sys/mman.h>
+#endif
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+#if !__linux__
+#error "CONFIG_MEMORY_POOL_REMOTE_FREE needs pthread"
+#endif
+#endif
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+#if !__linux__
+#error "CONFIG_MEMORY_POOL_ELASTIC needs mmap"
+#endif
+#include <sys/mman.h>
+#include <time.h>
+#endif
+
 #define MEMPOOL_INIT_READY 0
 #define MEMPOOL_INIT_DONE  1
 
-static INSRAM ALIGN_SIZE uint8_t mem1pool[MEM1_POOL_SIZE] = { 0 };
-static EXTRAM ALIGN_SIZE uint8_t mem2pool[MEM2_POOL_SIZE] = { 0 };
-static CCMRAM ALIGN_SIZE uint8_t mem3pool[MEM3_POOL_SIZE] = { 0 };
-static EXTRAM ALIGN_SIZE uint8_t mem4pool[MEM4_POOL_SIZE] = { 0 };
-static EXTRAM ALIGN_SIZE uint8_t mem5pool[MEM5_POOL_SIZE] = { 0 };
+#if CONFIG_MEMORY_POOL_RING
+#define MEM_RING_ALIGN 8           /* record and header granularity */
+#define MEM_RING_USED  0x55534544  /* "USED", record not freed yet */
+#define MEM_RING_FREE  0x46524545  /* "FREE", freed or wrap skip record */
+
+/* header in front of every ring record */
+typedef struct {
+    uint32_t len;    /* record length with the header */
+    uint32_t state;  /* MEM_RING_USED or MEM_RING_FREE */
+} mem_ring_hdr_t;
+#endif
+
+#if defined(__GNUC__)
+#define MEM_INLINE static inline __attribute__((always_inline))
+#else
+#define MEM_INLINE static inline
+#endif
+
+#if CONFIG_MEMORY_POOL_RING
+#define MEM_BANK_CHECK_TYPE(n)                                               \
+    _Static_assert(MEM##n##_TYPE <= MEM_TYPE_RING_SPSC,                      \
+                   "MEM" #n "_TYPE is unknown");                             \
+    _Static_assert((MEM##n##_TYPE == MEM_TYPE_BLOCK)                         \
+                       || ((MEM##n##_POOL_SIZE % MEM_RING_ALIGN == 0)        \
+                           && (MEM##n##_POOL_SIZE >= 4 * MEM_RING_ALIGN)),   \
+                   "MEM" #n "_POOL_SIZE is too small for a ring");
+#else
+#define MEM_BANK_CHECK_TYPE(n)                                               \
+    _Static_assert(MEM##n##_TYPE == MEM_TYPE_BLOCK,                          \
+                   "MEM" #n "_TYPE needs CONFIG_MEMORY_POOL_RING");
+#endif
+
+#define MEM_BANK_CHECK(memx, n, section)                                     \
+    _Static_assert((MEM##n##_BLOCK_SIZE & (MEM##n##_BLOCK_SIZE - 1)) == 0,   \
+                   "MEM" #n "_BLOCK_SIZE must be a power of two");           \
+    _Static_assert((1u << MEM##n##_BLOCK_SHIFT) == MEM##n##_BLOCK_SIZE,      \
+                   "MEM" #n "_BLOCK_SIZE is too large");                     \
+    _Static_assert((MEM##n##_POOL_SIZE > 0)                                  \
+                       && (MEM##n##_POOL_SIZE % MEM##n##_BLOCK_SIZE == 0),   \
+                   "MEM" #n "_POOL_SIZE must be a multiple of the block");   \
+    _Static_assert(MEM##n##_TABLE_SIZE <= 0xffff,                            \
+                   "MEM" #n " has more blocks than the table can count");    \
+    _Static_assert(MEM##n##_POLICY <= MEM_POLICY_BEST_FIT,                   \
+                   "MEM" #n "_POLICY is unknown");                           \
+    _Static_assert(MEM##n##_CHUNKS <= MEM_CHUNK_MAX,                         \
+                   "MEM" #n "_CHUNKS exceeds MEM_CHUNK_MAX");                \
+    MEM_BANK_CHECK_TYPE(n)                                                   \
+    _Static_assert(memx < SRAMBANK, #memx " is out of SRAMBANK");
+MEM_BANK_TABLE(MEM_BANK_CHECK)
+
+/* pool, allocation table and known-zero bitmap of every bank, a zero bit
+ * is set while the block is free and known to be zero
+ */
+#define MEM_BANK_STORAGE(memx, n, section)                                   \
+    static section ALIGN_SIZE uint8_t mem##n##pool[MEM##n##_POOL_SIZE]       \
+        = { 0 };                                                             \
+    static section uint16_t mem##n##table[MEM##n##_TABLE_SIZE] = { 0 };      \
+    static section uint8_t  mem##n##zero[(MEM##n##_TABLE_SIZE + 7) / 8]      \
+        = { 0 };
+MEM_BANK_TABLE(MEM_BANK_STORAGE)
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+/* a queued bit is set while a block freed by a foreign thread waits for
+ * the owner, the block itself is never written
+ */
+#define MEM_BANK_QUEUED_STORAGE(memx, n, section)                            \
+    static _Atomic uint32_t mem##n##queued[(MEM##n##_TABLE_SIZE + 31) / 32];
+MEM_BANK_TABLE(MEM_BANK_QUEUED_STORAGE)
+
+#define MEM_BANK_QUEUED(memx, n, section) mem##n##queued,
+static _Atomic uint32_t* const memqueued[SRAMBANK] = {
+    MEM_BANK_TABLE(MEM_BANK_QUEUED)
+};
+
+static struct {
+    _Atomic uint32_t pending;   /* non zero once a bit may be set */
+    atomic_bool      has_owner;
+    pthread_t        owner;
+} remote_free[SRAMBANK];
+#endif
 
-static INSRAM uint16_t mem1table[MEM1_TABLE_SIZE] = { 0 };
-static EXTRAM uint16_t mem2table[MEM2_TABLE_SIZE] = { 0 };
-static CCMRAM uint16_t mem3table[MEM3_TABLE_SIZE] = { 0 };
-static EXTRAM uint16_t mem4table[MEM4_TABLE_SIZE] = { 0 };
-static EXTRAM uint16_t mem5table[MEM5_TABLE_SIZE] = { 0 };
+#define MEM_BANK_TABLE_SIZE(memx, n, section) MEM##n##_TABLE_SIZE,
+#define MEM_BANK_BLOCK_SIZE(memx, n, section) MEM##n##_BLOCK_SIZE,
+#define MEM_BANK_POOL_SIZE(memx, n, section)  MEM##n##_POOL_SIZE,
+#define MEM_BANK_NAME(memx, n, section)       #memx,
+#define MEM_BANK_POOL(memx, n, section)       mem##n##pool,
+#define MEM_BANK_TABLE_PTR(memx, n, section)  mem##n##table,
+#define MEM_BANK_ZERO(memx, n, section)       mem##n##zero,
+#define MEM_BANK_POLICY(memx, n, section)     MEM##n##_POLICY,
+#define MEM_BANK_BACKING(memx, n, section)    MEM##n##_BACKING,
+#define MEM_BANK_CHUNKS(memx, n, section)                                    \
+    ((MEM##n##_TYPE == MEM_TYPE_BLOCK) ? MEM##n##_CHUNKS : 0),
+#define MEM_BANK_TYPE(memx, n, section)       MEM##n##_TYPE,
 
 static const uint32_t memtablesize[SRAMBANK] = {
-    MEM1_TABLE_SIZE,
-    MEM2_TABLE_SIZE,
-    MEM3_TABLE_SIZE,
-    MEM4_TABLE_SIZE,
-    MEM5_TABLE_SIZE
+    MEM_BANK_TABLE(MEM_BANK_TABLE_SIZE)
 };
 
 static const uint32_t memblocksize[SRAMBANK] = {
-    MEM1_BLOCK_SIZE,
-    MEM2_BLOCK_SIZE,
-    MEM3_BLOCK_SIZE,
-    MEM4_BLOCK_SIZE,
-    MEM5_BLOCK_SIZE
+    MEM_BANK_TABLE(MEM_BANK_BLOCK_SIZE)
 };
 
 static const uint32_t mempoolsize[SRAMBANK] = {
-    MEM1_POOL_SIZE,
-    MEM2_POOL_SIZE,
-    MEM3_POOL_SIZE,
-    MEM4_POOL_SIZE,
-    MEM5_POOL_SIZE
+    MEM_BANK_TABLE(MEM_BANK_POOL_SIZE)
+};
+
+static const char* const memname[SRAMBANK] = {
+    MEM_BANK_TABLE(MEM_BANK_NAME)
+};
+
+#if CONFIG_MEMORY_POOL_RING
+static const uint8_t memtype[SRAMBANK] = {
+    MEM_BANK_TABLE(MEM_BANK_TYPE)
 };
 
+/* byte offsets of a ring bank, head is only moved by the allocating side
+ * and tail by the freeing side, so a MEM_TYPE_RING_SPSC bank needs no lock
+ */
+static struct {
+    _Atomic uint32_t head;  /* next record */
+    _Atomic uint32_t tail;  /* oldest record not released yet */
+} mem_ring[SRAMBANK];
+#endif
+
+#if CONFIG_MEMORY_POOL_MMAP
+static const uint8_t membacking[SRAMBANK] = {
+    MEM_BANK_TABLE(MEM_BANK_BACKING)
+};
+#endif
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+static const uint8_t memchunks[SRAMBANK] = {
+    MEM_BANK_TABLE(MEM_BANK_CHUNKS)
+};
+
+/* extra chunk of an elastic bank, pool, table, known-zero and queued
+ * bitmaps share one mapping, pool is read without the bank lock to find a
+ * block's chunk
+ */
+typedef struct {
+    _Atomic(uint8_t*) pool;       /* NULL while not mapped */
+    uint16_t*         table;
+    uint8_t*          zero;
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    _Atomic uint32_t* queued;
+#endif
+    size_t            len;        /* mapping length */
+    uint32_t          cursor;     /* next fit roving cursor, in blocks */
+    uint32_t          used;       /* allocated blocks */
+    uint64_t          idle_since; /* ms, valid while used is 0 */
+    bool              released;   /* pages dropped by MADV_DONTNEED */
+} mem_chunk_t;
+
+static mem_chunk_t mem_chunk[SRAMBANK][MEM_CHUNK_MAX];
+static uint64_t    mem_chunk_deadline[SRAMBANK]; /* ms, 0 while none idles */
+#endif
+
 static struct  {
     void      (*init)(uint8_t);
     uint8_t   (*perused)(uint8_t);
     uint8_t*  mempool[SRAMBANK];
     uint16_t* memtable[SRAMBANK];
+    uint8_t*  memzero[SRAMBANK];
     uint8_t   memready[SRAMBANK];
+    uint8_t   mempolicy[SRAMBANK];
+    uint32_t  memcursor[SRAMBANK];  /* next fit roving cursor, in blocks */
+    uint32_t  zerocursor[SRAMBANK]; /* mem_zero_idle scan position */
+    uint32_t  memused[SRAMBANK];    /* allocated blocks */
+    uint8_t   membacking[SRAMBANK]; /* backing the pool really got */
+    uint32_t  memblocks[SRAMBANK];  /* capacity, pool and every chunk */
 } malloc_dev = {
     mymem_init,
 
     mem_perused,
 
-    {mem1pool,  mem2pool,  mem3pool,  mem4pool,  mem5pool},
+    { MEM_BANK_TABLE(MEM_BANK_POOL) },
+
+    { MEM_BANK_TABLE(MEM_BANK_TABLE_PTR) },
+
+    { MEM_BANK_TABLE(MEM_BANK_ZERO) },
+
+    { MEMPOOL_INIT_READY },
 
-    {mem1table, mem2table, mem3table, mem4table, mem5table},
+    { MEM_BANK_TABLE(MEM_BANK_POLICY) },
 
-    {MEMPOOL_INIT_READY, MEMPOOL_INIT_READY, MEMPOOL_INIT_READY,
-     MEMPOOL_INIT_READY, MEMPOOL_INIT_READY},
+    { 0 },
+
+    { 0 },
+
+    { 0 },
+
+    { MEM_BACKING_STATIC },
+
+    { MEM_BANK_TABLE(MEM_BANK_TABLE_SIZE) },
+};
+
+/* thresholds and state are atomic, a MEM_TYPE_RING_SPSC bank checks them
+ * without the bank lock
+ */
+typedef struct {
+    _Atomic uint32_t  low;      /* in blocks */
+    _Atomic uint32_t  high;     /* in blocks, 0xffffffff when disabled */
+    uint8_t           low_pct;
+    uint8_t           high_pct; /* 0 when disabled */
+    atomic_bool       in_high;
+    mem_pressure_cb_t cb;
+    void*             arg;
+    int               fd;
+} mem_pressure_t;
+
+#define MEM_BANK_PRESSURE(memx, n, section) \
+    { 0, 0xffffffff, 0, 0, false, NULL, NULL, -1 },
+
+static mem_pressure_t mem_pressure[SRAMBANK] = {
+    MEM_BANK_TABLE(MEM_BANK_PRESSURE)
 };
 
 #if __linux__
@@ -117,7 +307,135 @@ static void mutex_unlock(uint8_t memx)
 #endif
 }
 
-static uint32_t mymem_malloc(uint8_t memx, uint32_t size)
+static bool mymem_zero_test(const uint8_t* zero, uint32_t index)
+{
+    return zero[index >> 3] & (1u << (index & 7));
+}
+
+/* Take the known-zero bits of an allocated run. The dirty sub-range that
+ * still needs clearing is returned in [*start, *end), empty if start == end.
+ */
+MEM_INLINE void mymem_zero_take(uint8_t* zero, uint32_t index, uint32_t nmemb,
+                                uint32_t* start, uint32_t* end)
+{
+    *start = *end = index;
+
+    for (uint32_t i = index; i < (index + nmemb); i++) {
+        if (mymem_zero_test(zero, i)) {
+            zero[i >> 3] &= ~(1u << (i & 7));
+        } else {
+            if (*start == *end) {
+                *start = i;
+            }
+            *end = i + 1;
+        }
+    }
+}
+
+MEM_INLINE int32_t mymem_fit_top(const uint16_t* table, uint32_t table_size,
+                                 uint16_t need_block_count)
+{
+    uint16_t empty_block_size = 0;
+    for (int32_t offset = (table_size - 1); offset >= 0; offset--) {
+        empty_block_size = (table[offset] == 0) ? (empty_block_size + 1) : 0;
+
+        if (empty_block_size == need_block_count) {
+            return offset;
+        }
+    }
+
+    return -1;
+}
+
+/* Scan [start, end) upward for need_block_count free blocks. Every block
+ * of an allocation holds its block count, so once the scan is known to sit
+ * on an allocation boundary a used run is skipped in one step.
+ */
+MEM_INLINE int32_t mymem_fit_first(const uint16_t* table, uint32_t start,
+                                   uint32_t end, uint16_t need_block_count)
+{
+    uint16_t empty_block_size = 0;
+    bool     boundary         = (start == 0);
+
+    for (uint32_t i = start; i < end;) {
+        if (table[i] == 0) {
+            i++;
+            if (++empty_block_size == need_block_count) {
+                return i - need_block_count;
+            }
+            boundary = true;
+        } else {
+            empty_block_size = 0;
+            i += boundary ? table[i] : 1;
+        }
+    }
+
+    return -1;
+}
+
+MEM_INLINE int32_t mymem_fit_next(const uint16_t* table, uint32_t table_size,
+                                  uint32_t* cursor, uint16_t need_block_count)
+{
+    int32_t index
+        = mymem_fit_first(table, *cursor, table_size, need_block_count);
+    if ((index < 0) && *cursor) {
+        /* wrap around, a run may straddle the cursor */
+        uint32_t end = *cursor + need_block_count - 1;
+        if (end > table_size) {
+            end = table_size;
+        }
+        index = mymem_fit_first(table, 0, end, need_block_count);
+    }
+
+    if (index >= 0) {
+        uint32_t next = index + need_block_count;
+        *cursor       = (next < table_size) ? next : 0;
+    }
+
+    return index;
+}
+
+MEM_INLINE int32_t mymem_fit_best(const uint16_t* table, uint32_t table_size,
+                                  uint16_t need_block_count)
+{
+    int32_t  best      = -1;
+    uint32_t best_size = 0xffffffff;
+
+    for (uint32_t i = 0; i < table_size;) {
+        if (table[i]) {
+            i += table[i];
+            continue;
+        }
+
+        uint32_t start = i;
+        while ((i < table_size) && (table[i] == 0)) {
+            i++;
+        }
+
+        uint32_t size = i - start;
+        if ((size >= need_block_count) && (size < best_size)) {
+            best      = start;
+            best_size = size;
+            if (size == need_block_count) {
+                break;
+            }
+        }
+    }
+
+    return best;
+}
+
+/* Generic body of a bank alloc, only ever inlined into the per-bank
+ * specializations below so table_size and shift are constants. The dirty
+ * byte range the caller has to clear for a zeroed allocation is returned
+ * in [*dirty_start, *dirty_end).
+ */
+MEM_INLINE uint32_t mymem_malloc_impl(uint8_t memx, uint32_t size,
+                                      uint16_t* table, uint8_t* zero,
+                                      uint32_t* cursor, uint32_t table_size,
+                                      uint32_t shift,
+                                      uint32_t* dirty_start,
+                                      uint32_t* dirty_end)
 {
     if (malloc_dev.memready[memx] == MEMPOOL_INIT_READY) {
         malloc_dev.init(memx);
@@ -127,163 +445,1506 @@ static uint32_t mymem_malloc(uint8_t memx, uint32_t size)
         return 0xffffffff;
     }
 
-    uint16_t need_block_count = size / memblocksize[memx];
-    if (size % memblocksize[memx]) {
+    uint32_t need_block_count = size >> shift;
+    if (size & ((1u << shift) - 1)) {
         need_block_count++;
     }
 
-    uint16_t empty_block_size = 0;
-    for (int32_t offset = (memtablesize[memx] - 1); offset >= 0; offset--) {
-        if (offset < 0) {
-            return 0xffffffff;
-        }
+    if (need_block_count > table_size) {
+        return 0xffffffff;
+    }
 
-        empty_block_size = (malloc_dev.memtable[memx][offset] == 0)
-                               ? (empty_block_size + 1)
-                               : 0;
+    int32_t offset = -1;
+    switch (malloc_dev.mempolicy[memx]) {
+    case MEM_POLICY_FIRST_FIT:
+        offset = mymem_fit_first(table, 0, table_size, need_block_count);
+        break;
+    case MEM_POLICY_NEXT_FIT:
+        offset = mymem_fit_next(table, table_size, cursor, need_block_count);
+        break;
+    case MEM_POLICY_BEST_FIT:
+        offset = mymem_fit_best(table, table_size, need_block_count);
+        break;
+    default:
+        offset = mymem_fit_top(table, table_size, need_block_count);
+        break;
+    }
 
-        if (empty_block_size == need_block_count) {
-            for (uint32_t i = 0; i < need_block_count; i++) {
-                malloc_dev.memtable[memx][offset + i] = need_block_count;
-            }
-            /* offset address */
-            return (offset * memblocksize[memx]);
-        }
+    if (offset < 0) {
+        return 0xffffffff;
     }
 
-    return 0xffffffff;
+    for (uint32_t i = 0; i < need_block_count; i++) {
+        table[offset + i] = need_block_count;
+    }
+    malloc_dev.memused[memx] += need_block_count;
+
+    mymem_zero_take(zero, offset, need_block_count, dirty_start, dirty_end);
+    *dirty_start <<= shift;
+    *dirty_end <<= shift;
+
+    /* offset address */
+    return ((uint32_t)offset << shift);
 }
 
-static uint8_t mymem_free(uint8_t memx, uint32_t offset)
+/* return the number of blocks released */
+MEM_INLINE uint32_t mymem_free_impl(uint8_t memx, uint32_t offset,
+                                    uint16_t* table, uint32_t pool_size,
+                                    uint32_t shift)
 {
     if (!malloc_dev.memready[memx]) {
         malloc_dev.init(memx);
-        return 1;
+        return 0;
     }
 
-    if (offset < mempoolsize[memx]) {
-        int index = offset / memblocksize[memx];
-        int nmemb = malloc_dev.memtable[memx][index];
-        for (uint16_t i = 0; i < nmemb; i++) {
-            malloc_dev.memtable[memx][index + i] = 0;
+    if (offset < pool_size) {
+        uint32_t index = offset >> shift;
+        uint32_t nmemb = table[index];
+        for (uint32_t i = 0; i < nmemb; i++) {
+            table[index + i] = 0;
         }
-        return 0;
+        malloc_dev.memused[memx] -= nmemb;
+        return nmemb;
     }
-    return 2;
+    return 0;
 }
 
-void mymemcpy(void* des, void* src, uint32_t n)
-{
-    uint8_t* p_des = des;
-    uint8_t* p_src = src;
-    while (n--) {
-        *p_des++ = *p_src++;
+#define MEM_BANK_FUNC(memx, n, section)                                      \
+    static uint32_t mem##n##_malloc(uint32_t size, uint32_t* dirty_start,    \
+                                    uint32_t* dirty_end)                     \
+    {                                                                        \
+        return mymem_malloc_impl(memx, size, mem##n##table, mem##n##zero,    \
+                                 &malloc_dev.memcursor[memx],                \
+                                 MEM##n##_TABLE_SIZE, MEM##n##_BLOCK_SHIFT,  \
+                                 dirty_start, dirty_end);                    \
+    }                                                                        \
+                                                                             \
+    static uint32_t mem##n##_free(uint32_t offset)                           \
+    {                                                                        \
+        return mymem_free_impl(memx, offset, mem##n##table,                  \
+                               MEM##n##_POOL_SIZE, MEM##n##_BLOCK_SHIFT);    \
+    }
+MEM_BANK_TABLE(MEM_BANK_FUNC)
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+#define MEM_CHUNK_FUNC(memx, n, section)                                     \
+    static uint32_t mem##n##_chunk_malloc(mem_chunk_t* chunk, uint32_t size, \
+                                          uint32_t* dirty_start,             \
+                                          uint32_t* dirty_end)               \
+    {                                                                        \
+        uint32_t offset = mymem_malloc_impl(                                 \
+            memx, size, chunk->table, chunk->zero, &chunk->cursor,           \
+            MEM##n##_TABLE_SIZE, MEM##n##_BLOCK_SHIFT, dirty_start,          \
+            dirty_end);                                                      \
+        if (offset != 0xffffffff) {                                          \
+            chunk->used += chunk->table[offset >> MEM##n##_BLOCK_SHIFT];     \
+        }                                                                    \
+        return offset;                                                       \
+    }                                                                        \
+                                                                             \
+    static void mem##n##_chunk_free(mem_chunk_t* chunk, uint32_t offset)     \
+    {                                                                        \
+        chunk->used -= mymem_free_impl(memx, offset, chunk->table,           \
+                                       MEM##n##_POOL_SIZE,                   \
+                                       MEM##n##_BLOCK_SHIFT);                \
     }
+MEM_BANK_TABLE(MEM_CHUNK_FUNC)
+
+#define MEM_BANK_OPS(memx, n, section)                                       \
+    { mem##n##_malloc, mem##n##_free, mem##n##_chunk_malloc,                 \
+      mem##n##_chunk_free },
+#else
+#define MEM_BANK_OPS(memx, n, section) { mem##n##_malloc, mem##n##_free },
+#endif
+
+static const struct {
+    uint32_t (*malloc)(uint32_t size, uint32_t* dirty_start,
+                       uint32_t* dirty_end);
+    uint32_t (*free)(uint32_t offset);
+#if CONFIG_MEMORY_POOL_ELASTIC
+    uint32_t (*chunk_malloc)(mem_chunk_t* chunk, uint32_t size,
+                             uint32_t* dirty_start, uint32_t* dirty_end);
+    void     (*chunk_free)(mem_chunk_t* chunk, uint32_t offset);
+#endif
+} mymem_ops[SRAMBANK] = {
+    MEM_BANK_TABLE(MEM_BANK_OPS)
+};
+
+static uint32_t mymem_free(uint8_t memx, uint32_t offset)
+{
+    return mymem_ops[memx].free(offset);
 }
 
-void mymemset(void* src, uint8_t c, uint32_t count)
+#if CONFIG_MEMORY_POOL_RING
+/* bytes held by a ring, freed records behind the tail included */
+static uint32_t mymem_ring_bytes(uint8_t memx)
 {
-    uint8_t* p_des = src;
-    while (count--) {
-        *p_des++ = c;
+    uint32_t head = atomic_load_explicit(&mem_ring[memx].head,
+                                         memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&mem_ring[memx].tail,
+                                         memory_order_acquire);
+
+    return (head >= tail) ? (head - tail) : (mempoolsize[memx] - tail + head);
+}
+
+static uint32_t mymem_ring_blocks(uint8_t memx)
+{
+    return (mymem_ring_bytes(memx) + memblocksize[memx] - 1)
+           / memblocksize[memx];
+}
+
+/* Append a record at the head of a ring, return the payload offset. A
+ * record never wraps, if it does not fit in front of the pool end a skip
+ * record pads the rest and it goes to the start. head == tail means empty,
+ * so head never catches up with tail.
+ */
+static uint32_t mymem_ring_malloc(uint8_t memx, uint32_t size)
+{
+    if (malloc_dev.memready[memx] == MEMPOOL_INIT_READY) {
+        malloc_dev.init(memx);
+    }
+
+    uint32_t pool_size = mempoolsize[memx];
+    if ((size == 0) || (size > (pool_size - 2 * sizeof(mem_ring_hdr_t)))) {
+        return 0xffffffff;
+    }
+
+    uint32_t need = ((size + MEM_RING_ALIGN - 1) & ~(MEM_RING_ALIGN - 1))
+                    + sizeof(mem_ring_hdr_t);
+    uint8_t* pool = malloc_dev.mempool[memx];
+    uint32_t head = atomic_load_explicit(&mem_ring[memx].head,
+                                         memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&mem_ring[memx].tail,
+                                         memory_order_acquire);
+    uint32_t at   = head;
+
+    if (head >= tail) {
+        uint32_t room = pool_size - head;
+        if ((room < need) || ((room == need) && (tail == 0))) {
+            if (need >= tail) {
+                return 0xffffffff;
+            }
+
+            mem_ring_hdr_t* p_skip = (mem_ring_hdr_t*)(pool + head);
+            p_skip->len            = room;
+            p_skip->state          = MEM_RING_FREE;
+            at                     = 0;
+        }
+    } else if ((tail - head) <= need) {
+        return 0xffffffff;
     }
+
+    mem_ring_hdr_t* p_hdr = (mem_ring_hdr_t*)(pool + at);
+    p_hdr->len            = need;
+    p_hdr->state          = MEM_RING_USED;
+
+    uint32_t next = at + need;
+    atomic_store_explicit(&mem_ring[memx].head,
+                          (next == pool_size) ? 0 : next,
+                          memory_order_release);
+
+    return at + sizeof(mem_ring_hdr_t);
 }
 
-void mymem_init(uint8_t memx)
+/* Mark a record freed and move the tail over every freed record in front
+ * of it, a record freed out of order is released once the tail gets there.
+ */
+static void mymem_ring_free(uint8_t memx, void* ptr)
 {
-    mymemset(malloc_dev.memtable[memx],
-            0,
-            memtablesize[memx] * sizeof(uint16_t));
+    uint8_t* pool   = malloc_dev.mempool[memx];
+    uint32_t offset = (uintptr_t)ptr - (uintptr_t)pool;
 
-    mymemset(malloc_dev.mempool[memx],
-            0,
-            mempoolsize[memx]);
+    if ((offset < sizeof(mem_ring_hdr_t)) || (offset % MEM_RING_ALIGN)) {
+        return;
+    }
+
+    /* foreign pointers and double frees do not point behind a live header */
+    mem_ring_hdr_t* p_hdr = (mem_ring_hdr_t*)(pool + offset
+                                              - sizeof(mem_ring_hdr_t));
+    if (p_hdr->state != MEM_RING_USED) {
+        return;
+    }
+    p_hdr->state = MEM_RING_FREE;
 
-    malloc_dev.memready[memx] = MEMPOOL_INIT_DONE;
+    uint32_t head = atomic_load_explicit(&mem_ring[memx].head,
+                                         memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&mem_ring[memx].tail,
+                                         memory_order_relaxed);
+    while (tail != head) {
+        p_hdr = (mem_ring_hdr_t*)(pool + tail);
+        if (p_hdr->state != MEM_RING_FREE) {
+            break;
+        }
 
-    mutex_creat(memx);
+        tail += p_hdr->len;
+        if (tail == mempoolsize[memx]) {
+            tail = 0;
+        }
+    }
 
-#if CONFIG_MEMORY_POOL_DEBUG
-    memory_pool_debug_init();
+    if ((tail == head) && (memtype[memx] == MEM_TYPE_RING)) {
+        /* empty and under the bank lock, restart at the pool start */
+        atomic_store_explicit(&mem_ring[memx].head, 0, memory_order_relaxed);
+        tail = 0;
+    }
+    atomic_store_explicit(&mem_ring[memx].tail, tail, memory_order_release);
+}
 #endif
 
-    printf("Memory pool %d init done %s\n", memx, __TIMESTAMP__);
+/* used blocks, a MEM_TYPE_RING_SPSC bank does not maintain memused */
+static uint32_t mymem_used(uint8_t memx)
+{
+#if CONFIG_MEMORY_POOL_RING
+    if (memtype[memx] == MEM_TYPE_RING_SPSC) {
+        return mymem_ring_blocks(memx);
+    }
+#endif
+
+    return malloc_dev.memused[memx];
 }
 
-uint8_t mem_perused(uint8_t memx)
+/* check the watermarks after the usage changed, bank lock held except for
+ * MEM_TYPE_RING_SPSC banks, where the allocating and the freeing thread
+ * race for a transition and only the one that claims it reports it
+ */
+static uint8_t mymem_pressure(uint8_t memx)
 {
-    uint32_t used = 0;
-    for (uint32_t i = 0; i < memtablesize[memx]; i++) {
-        if (malloc_dev.memtable[memx][i]) {
-            used++;
+    mem_pressure_t* p_pressure = &mem_pressure[memx];
+    uint32_t        used       = mymem_used(memx);
+    bool            in_high    = atomic_load_explicit(&p_pressure->in_high,
+                                                      memory_order_relaxed);
+
+    if (!in_high) {
+        if ((used >= atomic_load_explicit(&p_pressure->high,
+                                          memory_order_relaxed))
+            && atomic_compare_exchange_strong(&p_pressure->in_high, &in_high,
+                                              true)) {
+            return MEM_PRESSURE_HIGH;
         }
+    } else if ((used <= atomic_load_explicit(&p_pressure->low,
+                                             memory_order_relaxed))
+               && atomic_compare_exchange_strong(&p_pressure->in_high,
+                                                 &in_high, false)) {
+        return MEM_PRESSURE_LOW;
     }
 
-    return (used * 100) / (memtablesize[memx]);
+    return 0;
 }
 
-void myfree(void* ptr, char* file_name, uint32_t func_line)
+/* deliver an event returned by mymem_pressure, bank lock released */
+static void mymem_pressure_notify(uint8_t memx, uint8_t event)
 {
-    uint32_t ptr_data = (uint32_t)(uintptr_t)ptr;
+    if (event == 0) {
+        return;
+    }
 
-    uint8_t memx = 0xff;
+    mutex_lock(memx);
+    mem_pressure_cb_t cb    = mem_pressure[memx].cb;
+    void*             arg   = mem_pressure[memx].arg;
+    uint8_t           usage = (mymem_used(memx) * 100)
+                    / malloc_dev.memblocks[memx];
+#if __linux__
+    int fd = mem_pressure[memx].fd;
+#endif
+    mutex_unlock(memx);
 
-    if (ptr != NULL) {
-        if ((ptr_data >= (uint32_t)(uintptr_t)mem1pool) &&
-            ((ptr_data < (uint32_t)(uintptr_t)mem1pool + MEM1_POOL_SIZE))) {
-            memx = SRAMIN;
-        } else if ( (ptr_data >= (uint32_t)(uintptr_t)mem2pool) &&
-                    ((ptr_data < (uint32_t)(uintptr_t)mem2pool + MEM2_POOL_SIZE))) {
-            memx = SRAMEX;
-        } else if ( (ptr_data >= (uint32_t)(uintptr_t)mem3pool) &&
-                    ((ptr_data < (uint32_t)(uintptr_t)mem3pool + MEM3_POOL_SIZE))) {
-            memx = SRAMCCM;
-        } else if ( (ptr_data >= (uint32_t)(uintptr_t)mem4pool) &&
-                    ((ptr_data < (uint32_t)(uintptr_t)mem4pool + MEM4_POOL_SIZE))) {
-            memx = SRAMEX1;
-        } else if ((ptr_data >= (uint32_t)(uintptr_t)mem5pool) &&
-                    ((ptr_data < (uint32_t)(uintptr_t)mem5pool + MEM5_POOL_SIZE))) {
-            memx = SRAMEX2;
-        } else {
-            memx = 0xff;
-        }
+#if __linux__
+    if (fd >= 0) {
+        uint64_t one = 1;
+        ssize_t  ret = write(fd, &one, sizeof(one));
+        UNUSED(ret);
     }
+#endif
 
-    if (memx != 0xff) {
-        mutex_lock(memx);
+    if (cb) {
+        cb(memx, event, usage, arg);
+    }
+}
 
-        uint32_t offset = (uintptr_t)ptr - (uintptr_t)malloc_dev.mempool[memx];
-        mymem_free(memx, offset);
-#if CONFIG_MEMORY_POOL_DEBUG
-        memory_pool_debug_del(ptr, file_name, func_line);
-#else
-    UNUSED(file_name);
-    UNUSED(func_line);
+/* convert the watermark percents to blocks of the bank capacity, bank
+ * lock held
+ */
+static void mymem_watermark(uint8_t memx)
+{
+    mem_pressure_t* p_pressure = &mem_pressure[memx];
+    uint32_t        blocks     = malloc_dev.memblocks[memx];
+
+    p_pressure->low  = ((uint32_t)p_pressure->low_pct * blocks) / 100;
+    p_pressure->high = p_pressure->high_pct
+                           ? (((uint32_t)p_pressure->high_pct * blocks + 99)
+                              / 100)
+                           : 0xffffffff;
+}
+
+#if CONFIG_MEMORY_POOL_MMAP
+/* prefault after MADV_HUGEPAGE, MAP_POPULATE would fault in small pages */
+static void mymem_populate(uint8_t* addr, size_t len)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(addr, len, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
 #endif
-        mutex_unlock(memx);
+
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < len; i += page) {
+        ((volatile uint8_t*)addr)[i] = 0;
     }
 }
 
-void* mymalloc(uint8_t memx, uint32_t size, char* file_name, uint32_t func_line)
+#endif
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+static uint64_t mymem_now_ms(void)
 {
-    mutex_lock(memx);
-    void* addr = NULL;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    uint32_t offset = mymem_malloc(memx, size);
-    if (offset != 0xffffffff) {
-        addr = (void*)((uintptr_t)malloc_dev.mempool[memx] + offset);
-#if CONFIG_MEMORY_POOL_DEBUG
-        memory_pool_debug_add(memx, size, addr, file_name, func_line);
+/* chunk holding addr plus one, 0 if none, safe without the bank lock */
+static uint32_t mymem_chunk_find(uint8_t memx, uintptr_t addr)
+{
+    for (uint32_t i = 0; i < memchunks[memx]; i++) {
+        uintptr_t pool = (uintptr_t)atomic_load_explicit(
+            &mem_chunk[memx][i].pool, memory_order_acquire);
+        if (pool && ((addr - pool) < mempoolsize[memx])) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint8_t* mymem_chunk_pool(uint8_t memx, uint32_t chunk_no)
+{
+    return atomic_load_explicit(&mem_chunk[memx][chunk_no - 1].pool,
+                                memory_order_relaxed);
+}
+
+/* a chunk became fully free, arm the trim deadline, bank lock held */
+static void mymem_chunk_idle(uint8_t memx, mem_chunk_t* chunk)
+{
+    chunk->idle_since = mymem_now_ms();
+    if (mem_chunk_deadline[memx] == 0) {
+        mem_chunk_deadline[memx] = chunk->idle_since + MEM_CHUNK_IDLE_MS;
+    }
+}
+
+/* prefault and lock the pages of a chunk as MEMn_BACKING asks, huge pages
+ * are left to the pool
+ */
+static void mymem_chunk_back(uint8_t memx, mem_chunk_t* chunk, uint8_t* addr)
+{
+#if CONFIG_MEMORY_POOL_MMAP
+    if (membacking[memx] & MEM_BACKING_POPULATE) {
+        mymem_populate(addr, mempoolsize[memx]);
+    }
+    if (membacking[memx] & MEM_BACKING_LOCK) {
+        mlock(addr, chunk->len);
+    }
 #else
-    UNUSED(file_name);
-    UNUSED(func_line);
+    UNUSED(memx);
+    UNUSED(chunk);
+    UNUSED(addr);
 #endif
-    }
+}
 
+static bool mymem_chunk_map(uint8_t memx, mem_chunk_t* chunk)
+{
+    size_t table  = (mempoolsize[memx] + 7) & ~(size_t)7;
+    size_t queued = table + ((memtablesize[memx] * sizeof(uint16_t) + 3)
+                             & ~(size_t)3);
+    size_t zero   = queued;
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    zero += ((memtablesize[memx] + 31) / 32) * sizeof(uint32_t);
+#endif
+    size_t len    = zero + (memtablesize[memx] + 7) / 8;
+
+    uint8_t* addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    chunk->table    = (uint16_t*)(addr + table);
+    chunk->zero     = addr + zero;
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    chunk->queued   = (_Atomic uint32_t*)(addr + queued);
+#endif
+    chunk->len      = len;
+    chunk->cursor   = 0;
+    chunk->used     = 0;
+    chunk->released = false;
+    mymem_chunk_back(memx, chunk, addr);
+    mymem_chunk_idle(memx, chunk);
+
+    /* a fresh anonymous mapping is zero already */
+    mymemset(chunk->zero, 0xff, (memtablesize[memx] + 7) / 8);
+
+    atomic_store_explicit(&chunk->pool, addr, memory_order_release);
+    return true;
+}
+
+/* hand a fully free chunk back to the OS, bank lock held */
+static void mymem_chunk_release(uint8_t memx, mem_chunk_t* chunk)
+{
+    uint8_t* pool = atomic_load_explicit(&chunk->pool, memory_order_relaxed);
+
+#if MEM_CHUNK_RELEASE == MEM_CHUNK_DONTNEED
+    if (!chunk->released) {
+        /* the table is all zero already, the pool reads back as zero,
+         * locked pages can not be dropped
+         */
+#if CONFIG_MEMORY_POOL_MMAP
+        if (membacking[memx] & MEM_BACKING_LOCK) {
+            munlock(pool, chunk->len);
+        }
+#endif
+        madvise(pool, chunk->len, MADV_DONTNEED);
+        mymemset(chunk->zero, 0xff, (memtablesize[memx] + 7) / 8);
+        chunk->released = true;
+    }
+#else
+    UNUSED(memx);
+    atomic_store_explicit(&chunk->pool, NULL, memory_order_release);
+    munmap(pool, chunk->len);
+#endif
+}
+
+/* release the chunks idle for MEM_CHUNK_IDLE_MS, bank lock held */
+static uint32_t mymem_chunk_trim(uint8_t memx, uint64_t now)
+{
+    uint32_t count    = 0;
+    uint64_t deadline = 0;
+
+    for (uint32_t i = 0; i < memchunks[memx]; i++) {
+        mem_chunk_t* chunk = &mem_chunk[memx][i];
+        if ((atomic_load_explicit(&chunk->pool, memory_order_relaxed) == NULL)
+            || chunk->used || chunk->released) {
+            continue;
+        }
+
+        if ((now - chunk->idle_since) >= MEM_CHUNK_IDLE_MS) {
+            mymem_chunk_release(memx, chunk);
+            count++;
+        } else if ((deadline == 0)
+                   || ((chunk->idle_since + MEM_CHUNK_IDLE_MS) < deadline)) {
+            deadline = chunk->idle_since + MEM_CHUNK_IDLE_MS;
+        }
+    }
+
+    /* the next call due to release a chunk still idling */
+    mem_chunk_deadline[memx] = deadline;
+    return count;
+}
+
+/* called on every locked alloc and free of the bank, so a chunk is also
+ * released when the bank is only touched after its idle time ran out
+ */
+static void mymem_chunk_tick(uint8_t memx)
+{
+    if (mem_chunk_deadline[memx] == 0) {
+        return;
+    }
+
+    uint64_t now = mymem_now_ms();
+    if (now >= mem_chunk_deadline[memx]) {
+        mymem_chunk_trim(memx, now);
+    }
+}
+
+/* allocate from the chunks once the pool is exhausted, mapping a new one
+ * if none fits, the chunk used is returned in *chunk_no
+ */
+static uint32_t mymem_chunk_malloc(uint8_t memx, uint32_t size,
+                                   uint32_t* chunk_no, uint32_t* dirty_start,
+                                   uint32_t* dirty_end)
+{
+    int32_t spare = -1;
+
+    /* chunks share the pool geometry, never map one for a request that can
+     * not fit in it
+     */
+    if ((size == 0) || (size > mempoolsize[memx])) {
+        return 0xffffffff;
+    }
+
+    for (uint32_t i = 0; i < memchunks[memx]; i++) {
+        mem_chunk_t* chunk = &mem_chunk[memx][i];
+        if (atomic_load_explicit(&chunk->pool, memory_order_relaxed) == NULL) {
+            if (spare < 0) {
+                spare = i;
+            }
+            continue;
+        }
+
+        uint32_t offset = mymem_ops[memx].chunk_malloc(chunk, size,
+                                                       dirty_start, dirty_end);
+        if (offset != 0xffffffff) {
+            if (chunk->released) {
+                /* MADV_DONTNEED dropped the prefaulted and locked pages */
+                mymem_chunk_back(memx, chunk, mymem_chunk_pool(memx, i + 1));
+                chunk->released = false;
+            }
+            *chunk_no = i + 1;
+            return offset;
+        }
+    }
+
+    if ((spare < 0) || !mymem_chunk_map(memx, &mem_chunk[memx][spare])) {
+        return 0xffffffff;
+    }
+
+    uint32_t offset = mymem_ops[memx].chunk_malloc(&mem_chunk[memx][spare],
+                                                   size, dirty_start,
+                                                   dirty_end);
+    if (offset != 0xffffffff) {
+        *chunk_no = spare + 1;
+    }
+    return offset;
+}
+
+static void mymem_chunk_free(uint8_t memx, uint32_t chunk_no, uintptr_t addr)
+{
+    mem_chunk_t* chunk = &mem_chunk[memx][chunk_no - 1];
+
+    mymem_ops[memx].chunk_free(
+        chunk, addr - (uintptr_t)mymem_chunk_pool(memx, chunk_no));
+
+    if (chunk->used == 0) {
+        mymem_chunk_idle(memx, chunk);
+    }
+}
+#endif
+
+/* release a block of a bank, pool or chunk, bank lock held */
+static void mymem_free_ptr(uint8_t memx, void* ptr)
+{
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)malloc_dev.mempool[memx];
+
+#if CONFIG_MEMORY_POOL_RING
+    if (memtype[memx] != MEM_TYPE_BLOCK) {
+        mymem_ring_free(memx, ptr);
+        malloc_dev.memused[memx] = mymem_ring_blocks(memx);
+        return;
+    }
+#endif
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    if (offset >= mempoolsize[memx]) {
+        uint32_t chunk_no = mymem_chunk_find(memx, (uintptr_t)ptr);
+        if (chunk_no) {
+            mymem_chunk_free(memx, chunk_no, (uintptr_t)ptr);
+        }
+        return;
+    }
+#endif
+
+    mymem_free(memx, offset);
+}
+
+/* bank owning ptr, 0xff if it is not from any pool */
+static uint8_t mymem_bank(void* ptr)
+{
+    uintptr_t addr = (uintptr_t)ptr;
+
+#define MEM_BANK_FIND(memx, n, section)                                      \
+    if ((addr - (uintptr_t)malloc_dev.mempool[memx]) < MEM##n##_POOL_SIZE) { \
+        return memx;                                                         \
+    }
+    MEM_BANK_TABLE(MEM_BANK_FIND)
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        if (mymem_chunk_find(memx, addr)) {
+            return memx;
+        }
+    }
+#endif
+
+    return 0xff;
+}
+
+#if CONFIG_MEMORY_POOL_TRACE
+/* trace object id of a block, chunks follow the pool in a linear space */
+static uint32_t mymem_object(uint8_t memx, void* ptr)
+{
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)malloc_dev.mempool[memx];
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    if (offset >= mempoolsize[memx]) {
+        uint32_t chunk_no = mymem_chunk_find(memx, (uintptr_t)ptr);
+        offset            = chunk_no * mempoolsize[memx]
+                 + ((uintptr_t)ptr
+                    - (uintptr_t)mymem_chunk_pool(memx, chunk_no));
+    }
+#endif
+
+    return offset;
+}
+#endif
+
+void mymemcpy(void* des, void* src, uint32_t n)
+{
+    uint8_t* p_des = des;
+    uint8_t* p_src = src;
+    while (n--) {
+        *p_des++ = *p_src++;
+    }
+}
+
+void mymemset(void* src, uint8_t c, uint32_t count)
+{
+    uint8_t* p_des = src;
+    while (count--) {
+        *p_des++ = c;
+    }
+}
+
+#if CONFIG_MEMORY_POOL_MMAP
+/* map a fresh zeroed pool for a bank, return the backing it really got */
+static uint8_t mymem_map(uint8_t memx)
+{
+    uint8_t  flags   = membacking[memx];
+    size_t   len     = mempoolsize[memx];
+    uint8_t  backing = MEM_BACKING_MMAP;
+    uint8_t* addr    = MAP_FAILED;
+
+    if (flags == MEM_BACKING_STATIC) {
+        return MEM_BACKING_STATIC;
+    }
+
+    if (len < MEM_HUGE_PAGE_SIZE) {
+        flags &= ~(MEM_BACKING_HUGETLB | MEM_BACKING_THP);
+    }
+
+#ifdef MAP_HUGETLB
+    if (flags & MEM_BACKING_HUGETLB) {
+        size_t huge_len = (len + MEM_HUGE_PAGE_SIZE - 1)
+                          & ~((size_t)MEM_HUGE_PAGE_SIZE - 1);
+        addr = mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+                        | ((flags & MEM_BACKING_POPULATE) ? MAP_POPULATE : 0),
+                    -1, 0);
+        if (addr != MAP_FAILED) {
+            backing |= MEM_BACKING_HUGETLB | (flags & MEM_BACKING_POPULATE);
+        }
+    }
+#endif
+
+    if (addr == MAP_FAILED) {
+        size_t map_len = len;
+        if (flags & MEM_BACKING_THP) {
+            /* over-map so the pool can start on a huge page boundary */
+            map_len += MEM_HUGE_PAGE_SIZE;
+        }
+
+        addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            return MEM_BACKING_STATIC;
+        }
+
+        if (flags & MEM_BACKING_THP) {
+            uint8_t* base = (uint8_t*)(((uintptr_t)addr + MEM_HUGE_PAGE_SIZE
+                                        - 1)
+                                       & ~((uintptr_t)MEM_HUGE_PAGE_SIZE - 1));
+            long     page = sysconf(_SC_PAGESIZE);
+            size_t   used = (len + page - 1) & ~((size_t)page - 1);
+
+            if (base != addr) {
+                munmap(addr, base - addr);
+            }
+            if ((addr + map_len) > (base + used)) {
+                munmap(base + used, (addr + map_len) - (base + used));
+            }
+            addr = base;
+
+            if (madvise(addr, len, MADV_HUGEPAGE) == 0) {
+                backing |= MEM_BACKING_THP;
+            }
+        }
+
+        if (flags & MEM_BACKING_POPULATE) {
+            mymem_populate(addr, len);
+            backing |= MEM_BACKING_POPULATE;
+        }
+    }
+
+    if ((flags & MEM_BACKING_LOCK) && (mlock(addr, len) == 0)) {
+        backing |= MEM_BACKING_LOCK;
+    }
+
+    malloc_dev.mempool[memx] = addr;
+    return backing;
+}
+#endif
+
+void mymem_init(uint8_t memx)
+{
+    mymemset(malloc_dev.memtable[memx],
+            0,
+            memtablesize[memx] * sizeof(uint16_t));
+
+    bool fresh = false;
+#if CONFIG_MEMORY_POOL_MMAP
+    if (malloc_dev.membacking[memx] == MEM_BACKING_STATIC) {
+        malloc_dev.membacking[memx] = mymem_map(memx);
+        fresh = (malloc_dev.membacking[memx] != MEM_BACKING_STATIC);
+    }
+#endif
+
+    /* a fresh anonymous mapping is zero already */
+    if (!fresh) {
+        mymemset(malloc_dev.mempool[memx],
+                0,
+                mempoolsize[memx]);
+    }
+
+    /* the whole pool is zero now */
+    mymemset(malloc_dev.memzero[memx],
+            0xff,
+            (memtablesize[memx] + 7) / 8);
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    for (uint32_t i = 0; i < memchunks[memx]; i++) {
+        uint8_t* pool = atomic_exchange_explicit(&mem_chunk[memx][i].pool,
+                                                 NULL, memory_order_release);
+        if (pool) {
+            munmap(pool, mem_chunk[memx][i].len);
+        }
+    }
+#endif
+
+    malloc_dev.memcursor[memx]  = 0;
+    malloc_dev.zerocursor[memx] = 0;
+    malloc_dev.memused[memx]    = 0;
+    malloc_dev.memblocks[memx]  = memtablesize[memx];
+#if CONFIG_MEMORY_POOL_ELASTIC
+    /* usage is measured against what the bank can grow to, so a pressure
+     * event still means it is about to fail
+     */
+    malloc_dev.memblocks[memx] *= 1 + memchunks[memx];
+#endif
+#if CONFIG_MEMORY_POOL_RING
+    atomic_store(&mem_ring[memx].head, 0);
+    atomic_store(&mem_ring[memx].tail, 0);
+#endif
+    mymem_watermark(memx);
+    mem_pressure[memx].in_high  = false;
+    malloc_dev.memready[memx]   = MEMPOOL_INIT_DONE;
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    for (uint32_t i = 0; i < (memtablesize[memx] + 31) / 32; i++) {
+        atomic_store(&memqueued[memx][i], 0);
+    }
+    atomic_store(&remote_free[memx].pending, 0);
+#endif
+
+    mutex_creat(memx);
+
+#if CONFIG_MEMORY_POOL_DEBUG
+    memory_pool_debug_init();
+#endif
+
+    printf("Memory pool %d init done %s\n", memx, __TIMESTAMP__);
+}
+
+uint8_t mem_perused(uint8_t memx)
+{
+#if CONFIG_MEMORY_POOL_RING
+    if (memtype[memx] != MEM_TYPE_BLOCK) {
+        return ((uint64_t)mymem_ring_bytes(memx) * 100) / mempoolsize[memx];
+    }
+#endif
+
+    mutex_lock(memx);
+    uint32_t used   = malloc_dev.memused[memx];
+    uint32_t blocks = malloc_dev.memblocks[memx];
+    mutex_unlock(memx);
+
+    return (used * 100) / blocks;
+}
+
+bool mem_set_watermark(uint8_t memx, uint8_t low, uint8_t high,
+                       mem_pressure_cb_t cb, void* arg)
+{
+    if ((memx >= SRAMBANK) || (high > 100) || (high && (low >= high))) {
+        return false;
+    }
+
+    mutex_lock(memx);
+
+    mem_pressure[memx].low_pct  = low;
+    mem_pressure[memx].high_pct = high;
+    mem_pressure[memx].in_high  = false;
+    mymem_watermark(memx);
+    mem_pressure[memx].cb       = cb;
+    mem_pressure[memx].arg      = arg;
+
+    mutex_unlock(memx);
+    return true;
+}
+
+#if __linux__
+int mem_pressure_eventfd(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return -1;
+    }
+
+    mutex_lock(memx);
+    if (mem_pressure[memx].fd < 0) {
+        mem_pressure[memx].fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+    int fd = mem_pressure[memx].fd;
+    mutex_unlock(memx);
+
+    return fd;
+}
+#endif
+
+const char* mem_name(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return NULL;
+    }
+
+    return memname[memx];
+}
+
+uint32_t mem_zero_idle(uint8_t memx, uint32_t max_blocks)
+{
+    if (memx >= SRAMBANK) {
+        return 0;
+    }
+
+    uint32_t count = 0;
+
+    mutex_lock(memx);
+
+    uint32_t index = malloc_dev.zerocursor[memx];
+    for (uint32_t n = 0; (n < memtablesize[memx]) && (count < max_blocks);
+         n++) {
+        if ((malloc_dev.memtable[memx][index] == 0)
+            && !mymem_zero_test(malloc_dev.memzero[memx], index)) {
+            mymemset(malloc_dev.mempool[memx] + index * memblocksize[memx], 0,
+                     memblocksize[memx]);
+            malloc_dev.memzero[memx][index >> 3] |= 1u << (index & 7);
+            count++;
+        }
+
+        if (++index == memtablesize[memx]) {
+            index = 0;
+        }
+    }
+    malloc_dev.zerocursor[memx] = index;
+
+    mutex_unlock(memx);
+    return count;
+}
+
+bool mem_set_policy(uint8_t memx, uint8_t policy)
+{
+    if ((memx >= SRAMBANK) || (policy > MEM_POLICY_BEST_FIT)) {
+        return false;
+    }
+
+#if CONFIG_MEMORY_POOL_RING
+    if (memtype[memx] != MEM_TYPE_BLOCK) {
+        return false;
+    }
+#endif
+
+    mutex_lock(memx);
+    malloc_dev.mempolicy[memx] = policy;
+    malloc_dev.memcursor[memx] = 0;
+#if CONFIG_MEMORY_POOL_ELASTIC
+    for (uint32_t i = 0; i < memchunks[memx]; i++) {
+        mem_chunk[memx][i].cursor = 0;
+    }
+#endif
+    mutex_unlock(memx);
+    return true;
+}
+
+uint8_t mem_get_policy(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return MEM_POLICY_TOP_FIT;
+    }
+
+    return malloc_dev.mempolicy[memx];
+}
+
+static void mymem_snapshot_run(mem_info_t* info, uint32_t* runs,
+                               uint32_t max_runs, uint32_t run_len,
+                               bool run_used)
+{
+    if (runs && (info->run_count < max_runs)) {
+        runs[info->run_count] = run_len | (run_used ? MEM_RUN_USED : 0);
+    }
+    info->run_count++;
+
+    if (run_used) {
+        info->used_blocks += run_len;
+    } else {
+        info->free_runs++;
+        if (run_len > info->largest_free_run) {
+            info->largest_free_run = run_len;
+        }
+    }
+}
+
+/* append the runs of one table to a snapshot, a run never spans tables */
+static void mymem_snapshot_runs(const uint16_t* table, uint32_t table_size,
+                                mem_info_t* info, uint32_t* runs,
+                                uint32_t max_runs)
+{
+    uint32_t run_len  = 0;
+    bool     run_used = false;
+    for (uint32_t i = 0; i <= table_size; i++) {
+        bool used = false;
+        if (i < table_size) {
+            used = (table[i] != 0);
+            if ((run_len == 0) || (used == run_used)) {
+                run_used = used;
+                run_len++;
+                continue;
+            }
+        }
+
+        /* close the current run */
+        mymem_snapshot_run(info, runs, max_runs, run_len, run_used);
+
+        run_used = used;
+        run_len  = 1;
+    }
+}
+
+#if CONFIG_MEMORY_POOL_RING
+/* runs of a ring in blocks, a block is used if it overlaps the bytes
+ * between tail and head, an SPSC ring can be empty anywhere in the pool
+ */
+static void mymem_snapshot_ring(uint8_t memx, mem_info_t* info,
+                                uint32_t* runs, uint32_t max_runs)
+{
+    uint32_t block = memblocksize[memx];
+    uint32_t head  = atomic_load_explicit(&mem_ring[memx].head,
+                                          memory_order_acquire);
+    uint32_t tail  = atomic_load_explicit(&mem_ring[memx].tail,
+                                          memory_order_acquire);
+
+    uint32_t run_len  = 0;
+    bool     run_used = false;
+    for (uint32_t i = 0; i <= memtablesize[memx]; i++) {
+        bool used = false;
+        if (i < memtablesize[memx]) {
+            uint32_t start = i * block;
+            uint32_t end   = start + block;
+            if (tail < head) {
+                used = (start < head) && (end > tail);
+            } else if (tail > head) {
+                used = (start < head) || (end > tail);
+            }
+
+            if ((run_len == 0) || (used == run_used)) {
+                run_used = used;
+                run_len++;
+                continue;
+            }
+        }
+
+        mymem_snapshot_run(info, runs, max_runs, run_len, run_used);
+
+        run_used = used;
+        run_len  = 1;
+    }
+}
+#endif
+
+bool mem_snapshot(uint8_t memx, mem_info_t* info, uint32_t* runs,
+                  uint32_t max_runs)
+{
+    if ((memx >= SRAMBANK) || (info == NULL)) {
+        return false;
+    }
+
+    mymemset(info, 0, sizeof(mem_info_t));
+    info->name        = memname[memx];
+    info->pool_size   = mempoolsize[memx];
+    info->block_size  = memblocksize[memx];
+    info->block_count = memtablesize[memx];
+
+    mutex_lock(memx);
+
+    info->ready   = malloc_dev.memready[memx];
+    info->policy  = malloc_dev.mempolicy[memx];
+    info->backing = malloc_dev.membacking[memx];
+
+#if CONFIG_MEMORY_POOL_RING
+    info->type = memtype[memx];
+    if (memtype[memx] != MEM_TYPE_BLOCK) {
+        /* a ring bank has no chunks */
+        mymem_snapshot_ring(memx, info, runs, max_runs);
+        mutex_unlock(memx);
+        return true;
+    }
+#endif
+
+    mymem_snapshot_runs(malloc_dev.memtable[memx], memtablesize[memx], info,
+                        runs, max_runs);
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    /* mapped chunks follow the pool in chunk order */
+    for (uint32_t i = 0; i < memchunks[memx]; i++) {
+        mem_chunk_t* chunk = &mem_chunk[memx][i];
+        if (atomic_load_explicit(&chunk->pool, memory_order_relaxed)) {
+            mymem_snapshot_runs(chunk->table, memtablesize[memx], info, runs,
+                                max_runs);
+            info->chunks++;
+        }
+    }
+
+    info->pool_size   += info->chunks * mempoolsize[memx];
+    info->block_count += info->chunks * memtablesize[memx];
+#endif
+
+    mutex_unlock(memx);
+    return true;
+}
+
+/* allocated blocks of a table, 0xffffffff if a run does not hold its own
+ * length in every entry or overruns the table
+ */
+static uint32_t mymem_check_table(const uint16_t* table, uint32_t table_size)
+{
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < table_size;) {
+        uint32_t nmemb = table[i];
+        if (nmemb == 0) {
+            i++;
+            continue;
+        }
+
+        if (nmemb > (table_size - i)) {
+            return 0xffffffff;
+        }
+        for (uint32_t j = 1; j < nmemb; j++) {
+            if (table[i + j] != nmemb) {
+                return 0xffffffff;
+            }
+        }
+
+        used += nmemb;
+        i    += nmemb;
+    }
+
+    return used;
+}
+
+#if CONFIG_MEMORY_POOL_RING
+/* walk the records from tail, they must line up with head */
+static bool mymem_check_ring(uint8_t memx)
+{
+    uint8_t* pool      = malloc_dev.mempool[memx];
+    uint32_t pool_size = mempoolsize[memx];
+    uint32_t head      = atomic_load_explicit(&mem_ring[memx].head,
+                                              memory_order_acquire);
+    uint32_t tail      = atomic_load_explicit(&mem_ring[memx].tail,
+                                              memory_order_acquire);
+
+    for (uint32_t n = 0; tail != head; n++) {
+        if ((n > (pool_size / MEM_RING_ALIGN))
+            || (tail > (pool_size - sizeof(mem_ring_hdr_t)))) {
+            return false;
+        }
+
+        mem_ring_hdr_t* p_hdr = (mem_ring_hdr_t*)(pool + tail);
+        if ((p_hdr->len < sizeof(mem_ring_hdr_t))
+            || (p_hdr->len % MEM_RING_ALIGN)
+            || (p_hdr->len > (pool_size - tail))
+            || ((p_hdr->state != MEM_RING_USED)
+                && (p_hdr->state != MEM_RING_FREE))) {
+            return false;
+        }
+
+        tail += p_hdr->len;
+        if (tail == pool_size) {
+            tail = 0;
+        }
+    }
+
+    return true;
+}
+#endif
+
+bool mem_check(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return false;
+    }
+
+    mutex_lock(memx);
+
+#if CONFIG_MEMORY_POOL_RING
+    if (memtype[memx] != MEM_TYPE_BLOCK) {
+        bool ok = mymem_check_ring(memx);
+        mutex_unlock(memx);
+        return ok;
+    }
+#endif
+
+    uint32_t used = mymem_check_table(malloc_dev.memtable[memx],
+                                      memtablesize[memx]);
+    bool     ok   = (used != 0xffffffff);
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    for (uint32_t i = 0; ok && (i < memchunks[memx]); i++) {
+        mem_chunk_t* chunk = &mem_chunk[memx][i];
+        if (atomic_load_explicit(&chunk->pool, memory_order_relaxed)) {
+            uint32_t chunk_used = mymem_check_table(chunk->table,
+                                                    memtablesize[memx]);
+            ok    = (chunk_used == chunk->used);
+            used += chunk_used;
+        }
+    }
+#endif
+
+    ok = ok && (used == malloc_dev.memused[memx]);
+
+    mutex_unlock(memx);
+    return ok;
+}
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+uint32_t mem_trim(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return 0;
+    }
+
+    mutex_lock(memx);
+    uint32_t count = mymem_chunk_trim(memx, mymem_now_ms());
+    uint8_t  event = mymem_pressure(memx);
     mutex_unlock(memx);
+
+    mymem_pressure_notify(memx, event);
+    return count;
+}
+#endif
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+void mem_set_owner(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return;
+    }
+
+    remote_free[memx].owner = pthread_self();
+    atomic_store_explicit(&remote_free[memx].has_owner, true,
+                          memory_order_release);
+}
+
+void mem_clear_owner(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return;
+    }
+
+    atomic_store_explicit(&remote_free[memx].has_owner, false,
+                          memory_order_release);
+    mem_drain(memx);
+}
+
+/* mark a block freed by a foreign thread, false if the caller has to free
+ * it under the bank lock
+ */
+static bool remote_free_push(uint8_t memx, void* ptr)
+{
+    if (!atomic_load_explicit(&remote_free[memx].has_owner,
+                              memory_order_acquire)
+        || pthread_equal(remote_free[memx].owner, pthread_self())) {
+        return false;
+    }
+
+    _Atomic uint32_t* queued = memqueued[memx];
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)malloc_dev.mempool[memx];
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    if (offset >= mempoolsize[memx]) {
+        uint32_t chunk_no = mymem_chunk_find(memx, (uintptr_t)ptr);
+        if (chunk_no == 0) {
+            return false;
+        }
+        queued = mem_chunk[memx][chunk_no - 1].queued;
+        offset = (uintptr_t)ptr - (uintptr_t)mymem_chunk_pool(memx, chunk_no);
+    }
+#endif
+
+    /* anything but the start of a block takes the checked locked path */
+    if ((offset >= mempoolsize[memx]) || (offset % memblocksize[memx])) {
+        return false;
+    }
+
+    uint32_t index = offset / memblocksize[memx];
+    uint32_t bit   = 1u << (index & 31);
+
+    /* a block already queued is a double free, never release it twice */
+    if ((atomic_fetch_or_explicit(&queued[index >> 5], bit,
+                                  memory_order_release) & bit) == 0) {
+        atomic_store_explicit(&remote_free[memx].pending, 1,
+                              memory_order_release);
+    }
+
+    return true;
+}
+
+/* release the queued blocks of one pool, bank lock held */
+static uint32_t remote_free_drain_pool(uint8_t memx, _Atomic uint32_t* queued,
+                                       uint8_t* pool, const uint16_t* table)
+{
+    uint32_t count = 0;
+
+    for (uint32_t word = 0; word < (memtablesize[memx] + 31) / 32; word++) {
+        if (atomic_load_explicit(&queued[word], memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        uint32_t bits = atomic_exchange_explicit(&queued[word], 0,
+                                                 memory_order_acquire);
+        for (uint32_t i = 0; bits; i++, bits >>= 1) {
+            uint32_t index = word * 32 + i;
+
+            /* a block freed again after its release is not live anymore */
+            if ((bits & 1) && table[index]) {
+                mymem_free_ptr(memx, pool + index * memblocksize[memx]);
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+/* must be called with the bank lock held */
+static uint32_t remote_free_drain(uint8_t memx)
+{
+    /* a bit is set ahead of pending, so none is missed once it is cleared */
+    if ((atomic_load_explicit(&remote_free[memx].pending, memory_order_relaxed)
+         == 0)
+        || (atomic_exchange_explicit(&remote_free[memx].pending, 0,
+                                     memory_order_acquire)
+            == 0)) {
+        return 0;
+    }
+
+    uint32_t count = remote_free_drain_pool(memx, memqueued[memx],
+                                            malloc_dev.mempool[memx],
+                                            malloc_dev.memtable[memx]);
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    for (uint32_t i = 0; i < memchunks[memx]; i++) {
+        mem_chunk_t* chunk = &mem_chunk[memx][i];
+        uint8_t*     pool  = atomic_load_explicit(&chunk->pool,
+                                                  memory_order_relaxed);
+        if (pool) {
+            count += remote_free_drain_pool(memx, chunk->queued, pool,
+                                            chunk->table);
+        }
+    }
+#endif
+
+    return count;
+}
+
+uint32_t mem_drain(uint8_t memx)
+{
+    if (memx >= SRAMBANK) {
+        return 0;
+    }
+
+    mutex_lock(memx);
+    uint32_t count = remote_free_drain(memx);
+    uint8_t  event = mymem_pressure(memx);
+    mutex_unlock(memx);
+
+    mymem_pressure_notify(memx, event);
+    return count;
+}
+#endif
+
+void myfree(void* ptr, char* file_name, uint32_t func_line)
+{
+    uint8_t memx = 0xff;
+
+    if (ptr != NULL) {
+        memx = mymem_bank(ptr);
+    }
+
+    if (memx != 0xff) {
+#if CONFIG_MEMORY_POOL_TRACE
+        /* record ahead of the release, the block may be reused right after */
+        memory_pool_trace_free(memx, mymem_object(memx, ptr), file_name,
+                               func_line);
+#endif
+
+#if CONFIG_MEMORY_POOL_DEBUG
+        memory_pool_debug_del(ptr, file_name, func_line);
+#else
+        UNUSED(file_name);
+        UNUSED(func_line);
+#endif
+
+#if CONFIG_MEMORY_POOL_RING
+        if (memtype[memx] == MEM_TYPE_RING_SPSC) {
+            mymem_ring_free(memx, ptr);
+            mymem_pressure_notify(memx, mymem_pressure(memx));
+            return;
+        }
+#endif
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+        /* ring records have no block table to queue them in */
+#if CONFIG_MEMORY_POOL_RING
+        bool queue = (memtype[memx] == MEM_TYPE_BLOCK);
+#else
+        bool queue = true;
+#endif
+        if (queue && remote_free_push(memx, ptr)) {
+            return;
+        }
+#endif
+
+        mutex_lock(memx);
+
+        mymem_free_ptr(memx, ptr);
+#if CONFIG_MEMORY_POOL_ELASTIC
+        mymem_chunk_tick(memx);
+#endif
+        uint8_t event = mymem_pressure(memx);
+
+        mutex_unlock(memx);
+
+        mymem_pressure_notify(memx, event);
+    }
+}
+
+/* allocate from the pool of a block bank, bank lock held */
+static uint32_t mymem_block_malloc(uint8_t memx, uint32_t size,
+                                   uint32_t* dirty_start, uint32_t* dirty_end)
+{
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    remote_free_drain(memx);
+#endif
+#if CONFIG_MEMORY_POOL_ELASTIC
+    mymem_chunk_tick(memx);
+#endif
+
+    return mymem_ops[memx].malloc(size, dirty_start, dirty_end);
+}
+
+static void* mymem_alloc(uint8_t memx, uint32_t size, bool zero,
+                         char* file_name, uint32_t func_line)
+{
+    uint32_t dirty_start = 0;
+    uint32_t dirty_end   = 0;
+#if CONFIG_MEMORY_POOL_RING
+    bool     locked      = (memtype[memx] != MEM_TYPE_RING_SPSC);
+#else
+    bool     locked      = true;
+#endif
+    uint32_t offset;
+
+    if (locked) {
+        mutex_lock(memx);
+    }
+    void* addr = NULL;
+
+#if CONFIG_MEMORY_POOL_RING
+    if (memtype[memx] != MEM_TYPE_BLOCK) {
+        /* ring records are not tracked as known zero */
+        offset = mymem_ring_malloc(memx, size);
+        if (offset != 0xffffffff) {
+            dirty_start = offset;
+            dirty_end   = offset + size;
+            if (locked) {
+                malloc_dev.memused[memx] = mymem_ring_blocks(memx);
+            }
+        }
+    } else {
+        offset = mymem_block_malloc(memx, size, &dirty_start, &dirty_end);
+    }
+#else
+    offset = mymem_block_malloc(memx, size, &dirty_start, &dirty_end);
+#endif
+
+    /* the pool is only known after the lazy init of the first malloc */
+    uint8_t* pool = malloc_dev.mempool[memx];
+#if CONFIG_MEMORY_POOL_ELASTIC
+    uint32_t chunk_no = 0;
+    if ((offset == 0xffffffff) && memchunks[memx]) {
+        offset = mymem_chunk_malloc(memx, size, &chunk_no, &dirty_start,
+                                    &dirty_end);
+        if (offset != 0xffffffff) {
+            pool = mymem_chunk_pool(memx, chunk_no);
+        }
+    }
+#endif
+    if (offset != 0xffffffff) {
+        addr = (void*)((uintptr_t)pool + offset);
+#if CONFIG_MEMORY_POOL_DEBUG
+        memory_pool_debug_add(memx, size, addr, file_name, func_line);
+#else
+    UNUSED(file_name);
+    UNUSED(func_line);
+#endif
+    }
+
+    if (locked) {
+        uint8_t event = mymem_pressure(memx);
+
+        mutex_unlock(memx);
+
+        mymem_pressure_notify(memx, event);
+    } else {
+        mymem_pressure_notify(memx, mymem_pressure(memx));
+    }
+
+    /* the run is owned by the caller now, clear it outside the lock */
+    if (zero && (dirty_start != dirty_end)) {
+        mymemset(pool + dirty_start, 0, dirty_end - dirty_start);
+    }
+
+#if CONFIG_MEMORY_POOL_TRACE
+    memory_pool_trace_malloc(zero ? MEMORY_POOL_TRACE_CALLOC
+                                  : MEMORY_POOL_TRACE_MALLOC,
+                             memx, size,
+                             addr ? mymem_object(memx, addr)
+                                  : MEMORY_POOL_TRACE_NO_OBJECT,
+                             file_name, func_line);
+#endif
+
     return addr;
 }
 
+void* mymalloc(uint8_t memx, uint32_t size, char* file_name, uint32_t func_line)
+{
+    return mymem_alloc(memx, size, false, file_name, func_line);
+}
+
+void* mycalloc(uint8_t memx, uint32_t nmemb, uint32_t size, char* file_name,
+               uint32_t func_line)
+{
+    if (size && (nmemb > (UINT32_MAX / size))) {
+        return NULL;
+    }
+
+    return mymem_alloc(memx, nmemb * size, true, file_name, func_line);
+}
+
 #if 0
 void* myrealloc(uint8_t memx, void* ptr, uint32_t size)
 {
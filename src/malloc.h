@@ -25,55 +25,149 @@
 #define UNUSED(x) ((void)(x))
 #endif /* UNUSED */
 
-#define SRAMIN   0x00
-#define SRAMEX   0x01
-#define SRAMCCM  0x02
-#define SRAMEX1  0x03
-#define SRAMEX2  0x04
-#define SRAMBANK (SRAMEX2 + 1)
-
-#define INSRAM        // __attribute__((at(0x30000000 + 0x00000000)));
-#define EXTRAM        // __attribute__((at(0x40000000 + 0x00000000)));
-#define CCMRAM        // __attribute__((at(0x50000000 + 0x00000000)));
-
-#define ALIGN_SIZE    // __align(4)
-
-#define MEM1_BLOCK_SIZE   32
-#define MEM1_POOL_SIZE    100 * 1024
-#define MEM1_TABLE_SIZE   MEM1_POOL_SIZE / MEM1_BLOCK_SIZE
-
-#define MEM2_BLOCK_SIZE   32
-#define MEM2_POOL_SIZE    100 * 1024
-#define MEM2_TABLE_SIZE   MEM2_POOL_SIZE / MEM2_BLOCK_SIZE
-
-#define MEM3_BLOCK_SIZE   32
-#define MEM3_POOL_SIZE    32
-#define MEM3_TABLE_SIZE   MEM3_POOL_SIZE / MEM3_BLOCK_SIZE
-
-#define MEM4_BLOCK_SIZE   32
-#define MEM4_POOL_SIZE    50 * 1024
-#define MEM4_TABLE_SIZE   MEM4_POOL_SIZE / MEM4_BLOCK_SIZE
-
-#define MEM5_BLOCK_SIZE   32
-#define MEM5_POOL_SIZE    50 * 1024
-#define MEM5_TABLE_SIZE   MEM5_POOL_SIZE / MEM5_BLOCK_SIZE
+/* block placement policy of a bank */
+#define MEM_POLICY_TOP_FIT   0x00  /* scan down from the top of the table */
+#define MEM_POLICY_FIRST_FIT 0x01  /* lowest address run that fits */
+#define MEM_POLICY_NEXT_FIT  0x02  /* first fit from a roving cursor */
+#define MEM_POLICY_BEST_FIT  0x03  /* smallest free run that fits */
+
+/* allocator type of a bank, rings need CONFIG_MEMORY_POOL_RING */
+#define MEM_TYPE_BLOCK     0x00  /* block table, frees in any order */
+#define MEM_TYPE_RING      0x01  /* FIFO ring of variable length records */
+#define MEM_TYPE_RING_SPSC 0x02  /* lock-free ring, one allocating thread and
+                                  * one freeing thread */
+
+/* pool backing of a bank, see CONFIG_MEMORY_POOL_MMAP */
+#define MEM_BACKING_STATIC   0x00  /* static array in .bss */
+#define MEM_BACKING_HUGETLB  0x01  /* explicit huge pages, MAP_HUGETLB */
+#define MEM_BACKING_THP      0x02  /* transparent huge pages, MADV_HUGEPAGE */
+#define MEM_BACKING_POPULATE 0x04  /* pre-fault every page at init */
+#define MEM_BACKING_LOCK     0x08  /* mlock the pool */
+#define MEM_BACKING_MMAP     0x10  /* set when the pool got mmap'd */
+
+#include "mem_config.h"
+
+/* memory pressure events of a bank */
+#define MEM_PRESSURE_HIGH 0x01  /* usage reached the high watermark */
+#define MEM_PRESSURE_LOW  0x02  /* usage fell back to the low watermark */
+
+typedef void (*mem_pressure_cb_t)(uint8_t memx, uint8_t event, uint8_t usage,
+                                  void* arg);
+
+typedef struct {
+    const char* name;
+    uint8_t     ready;
+    uint8_t     policy;
+    uint8_t     type;          /* MEM_TYPE_xxx */
+    uint8_t     backing;       /* MEM_BACKING_xxx the pool really got */
+    uint32_t    pool_size;
+    uint32_t    block_size;
+    uint32_t    block_count;
+    uint32_t    used_blocks;
+    uint32_t    free_runs;
+    uint32_t    largest_free_run;
+    uint32_t    run_count;     /* total runs, may exceed the runs buffer */
+    uint32_t    chunks;        /* mapped chunks of an elastic bank */
+} mem_info_t;
+
+/* heap map run entry: run length in blocks, MEM_RUN_USED set if allocated */
+#define MEM_RUN_USED     0x80000000u
+#define MEM_RUN_LEN(run) ((run) & ~MEM_RUN_USED)
 
 #define MYMALLOC(memx, size) mymalloc((memx), (size), __FILE__, __LINE__)
+#define MYCALLOC(memx, nmemb, size) \
+    mycalloc((memx), (nmemb), (size), __FILE__, __LINE__)
 #define MYFREE(ptr)          myfree((ptr), __FILE__, __LINE__)
 
 void mymem_init(uint8_t memx);
 
 void* mymalloc(uint8_t memx, uint32_t size, char* file_name, uint32_t func_line);
 
+/* zeroed allocation of nmemb * size bytes, NULL if the product overflows,
+ * blocks still known to be zero are not cleared again
+ */
+void* mycalloc(uint8_t memx, uint32_t nmemb, uint32_t size, char* file_name,
+               uint32_t func_line);
+
 void myfree(void* ptr, char* file_name, uint32_t func_line);
 
 void mymemset(void* src, uint8_t c, uint32_t count);
 
 void mymemcpy(void* des, void* src, uint32_t size);
 
-/* just for debug, print memory use information */
+/* just for debug, print memory use information, an elastic bank counts
+ * against its pool plus all MEMn_CHUNKS chunks, mapped or not
+ */
 uint8_t mem_perused(uint8_t memx);
 
+const char* mem_name(uint8_t memx);
+
+/* clear at most max_blocks freed blocks of a bank so later mycalloc()
+ * calls can skip them, meant for idle or background tasks, return the
+ * number of blocks cleared
+ */
+uint32_t mem_zero_idle(uint8_t memx, uint32_t max_blocks);
+
+/* select the block placement policy of a block bank, MEM_POLICY_xxx */
+bool mem_set_policy(uint8_t memx, uint8_t policy);
+
+uint8_t mem_get_policy(uint8_t memx);
+
+/* Set usage watermarks of a bank in percent. MEM_PRESSURE_HIGH fires once
+ * usage reaches high, MEM_PRESSURE_LOW fires once it falls back to low.
+ * The callback runs on the allocating or freeing thread right after the
+ * bank lock is released, so it may allocate or free itself. A high of 0
+ * disables the watermarks. Percents of an elastic bank are of its pool plus
+ * all MEMn_CHUNKS chunks, so MEM_PRESSURE_HIGH means it is about to fail
+ * rather than that a chunk gets mapped. A MEM_TYPE_RING_SPSC bank checks
+ * them from its lock-free head and tail and only takes the bank lock to
+ * deliver an event.
+ */
+bool mem_set_watermark(uint8_t memx, uint8_t low, uint8_t high,
+                       mem_pressure_cb_t cb, void* arg);
+
+#if __linux__
+/* eventfd of a bank, incremented on every pressure event, -1 on error */
+int mem_pressure_eventfd(uint8_t memx);
+#endif
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+/* bind a bank to the calling thread, frees from any other thread are then
+ * pushed onto a lock-free queue and released in a batch by the next
+ * allocation from the bank instead of taking the bank lock
+ */
+void mem_set_owner(uint8_t memx);
+
+void mem_clear_owner(uint8_t memx);
+
+/* release all queued remote frees of a bank, return the released count */
+uint32_t mem_drain(uint8_t memx);
+#endif
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+/* release the chunks of an elastic bank that stayed fully free for
+ * MEM_CHUNK_IDLE_MS, return the number of chunks released. Allocs and
+ * frees of the bank already release them once their time ran out, call it
+ * from an idle or timer task for a bank that may go quiet.
+ */
+uint32_t mem_trim(uint8_t memx);
+#endif
+
+/* snapshot bank state and its run-length heap map under the bank lock,
+ * at most max_runs entries are stored in runs, which may be NULL. The
+ * sizes, counts and runs of an elastic bank cover its mapped chunks too.
+ */
+bool mem_snapshot(uint8_t memx, mem_info_t* info, uint32_t* runs,
+                  uint32_t max_runs);
+
+/* Check the allocator state of a bank under the bank lock: every run of
+ * the allocation table holds its length in each entry and the runs add
+ * up to the used block counter, chunks included, and the records of a
+ * ring line up from tail to head. A MEM_TYPE_RING_SPSC bank must be idle.
+ * Return false on corruption.
+ */
+bool mem_check(uint8_t memx);
+
 #if 0
 void* myrealloc(uint8_t memx, void* ptr, uint32_t size);
 #endif
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef _MEM_CONFIG_H_
+#define _MEM_CONFIG_H_
+
+/* Memory pool configuration, banks are declared in this file only.
+ *
+ * MEM_BANK_TABLE lists every bank as X(memx, n, section): the bank id,
+ * the index n selecting its MEMn_xxx values below and its ram section.
+ * The allocator generates the pool storage and a specialized alloc/free
+ * path per bank from it, so block size math folds into shifts and masks.
+ * The build reads the indexes from it for its -DMEMn_xxx overrides.
+ *
+ * Adding a bank takes, all in this file:
+ *  - a SRAMxx id, with SRAMBANK kept one past the last id,
+ *  - its X() entry in MEM_BANK_TABLE,
+ *  - its MEMn_BLOCK_SIZE, POOL_SIZE, POLICY, TYPE, BACKING and CHUNKS
+ *    defaults and its MEMn_TABLE_SIZE and MEMn_BLOCK_SHIFT below.
+ *
+ * Every MEMn_xxx value can be overridden from the build, either by
+ * `cmake -DMEM1_POOL_SIZE=65536` or by defining it ahead in CFLAGS.
+ * Block sizes must be a power of two that divides the pool size, and a
+ * bank has at most 65535 blocks, which is checked at compile time.
+ */
+
+#define SRAMIN   0x00
+#define SRAMEX   0x01
+#define SRAMCCM  0x02
+#define SRAMEX1  0x03
+#define SRAMEX2  0x04
+#define SRAMBANK (SRAMEX2 + 1)
+
+#define MEM_BANK_TABLE(X)     \
+    X(SRAMIN,  1, INSRAM)     \
+    X(SRAMEX,  2, EXTRAM)     \
+    X(SRAMCCM, 3, CCMRAM)     \
+    X(SRAMEX1, 4, EXTRAM)     \
+    X(SRAMEX2, 5, EXTRAM)
+
+#define INSRAM        // __attribute__((at(0x30000000 + 0x00000000)));
+#define EXTRAM        // __attribute__((at(0x40000000 + 0x00000000)));
+#define CCMRAM        // __attribute__((at(0x50000000 + 0x00000000)));
+
+#if defined(__GNUC__)
+#define ALIGN_SIZE    __attribute__((aligned(8)))
+#else
+#define ALIGN_SIZE    // __align(4)
+#endif
+
+#ifndef MEM1_BLOCK_SIZE
+#define MEM1_BLOCK_SIZE   (32)
+#endif
+#ifndef MEM1_POOL_SIZE
+#define MEM1_POOL_SIZE    (100 * 1024)
+#endif
+#ifndef MEM1_POLICY
+#define MEM1_POLICY       MEM_POLICY_TOP_FIT
+#endif
+
+#ifndef MEM2_BLOCK_SIZE
+#define MEM2_BLOCK_SIZE   (32)
+#endif
+#ifndef MEM2_POOL_SIZE
+#define MEM2_POOL_SIZE    (100 * 1024)
+#endif
+#ifndef MEM2_POLICY
+#define MEM2_POLICY       MEM_POLICY_TOP_FIT
+#endif
+
+#ifndef MEM3_BLOCK_SIZE
+#define MEM3_BLOCK_SIZE   (32)
+#endif
+#ifndef MEM3_POOL_SIZE
+#define MEM3_POOL_SIZE    (32)
+#endif
+#ifndef MEM3_POLICY
+#define MEM3_POLICY       MEM_POLICY_TOP_FIT
+#endif
+
+#ifndef MEM4_BLOCK_SIZE
+#define MEM4_BLOCK_SIZE   (32)
+#endif
+#ifndef MEM4_POOL_SIZE
+#define MEM4_POOL_SIZE    (50 * 1024)
+#endif
+#ifndef MEM4_POLICY
+#define MEM4_POLICY       MEM_POLICY_TOP_FIT
+#endif
+
+#ifndef MEM5_BLOCK_SIZE
+#define MEM5_BLOCK_SIZE   (32)
+#endif
+#ifndef MEM5_POOL_SIZE
+#define MEM5_POOL_SIZE    (50 * 1024)
+#endif
+#ifndef MEM5_POLICY
+#define MEM5_POLICY       MEM_POLICY_TOP_FIT
+#endif
+
+/* Allocator type of a bank. A MEM_TYPE_RING bank hands out variable length
+ * records in FIFO order from a head offset and releases them at the tail,
+ * a record freed ahead of the tail is released once the tail reaches it.
+ * MEM_TYPE_RING_SPSC drops the bank lock for one allocating and one
+ * freeing thread. Ring pools must be a multiple of 8 bytes, and ring types
+ * need CONFIG_MEMORY_POOL_RING.
+ */
+#ifndef MEM1_TYPE
+#define MEM1_TYPE         MEM_TYPE_BLOCK
+#endif
+#ifndef MEM2_TYPE
+#define MEM2_TYPE         MEM_TYPE_BLOCK
+#endif
+#ifndef MEM3_TYPE
+#define MEM3_TYPE         MEM_TYPE_BLOCK
+#endif
+#ifndef MEM4_TYPE
+#define MEM4_TYPE         MEM_TYPE_BLOCK
+#endif
+#ifndef MEM5_TYPE
+#define MEM5_TYPE         MEM_TYPE_BLOCK
+#endif
+
+/* Pool backing when CONFIG_MEMORY_POOL_MMAP is enabled: the pool is
+ * mmap'd at mymem_init() instead of living in .bss. Explicit huge pages
+ * fall back to transparent ones, then to plain pages and finally to the
+ * static array, huge pages are only tried for pools of at least
+ * MEM_HUGE_PAGE_SIZE. MEMn_BACKING picks the flags per bank.
+ */
+#if CONFIG_MEMORY_POOL_MMAP
+#define MEM_BACKING_DEFAULT                                                 \
+    (MEM_BACKING_HUGETLB | MEM_BACKING_THP | MEM_BACKING_POPULATE)
+#else
+#define MEM_BACKING_DEFAULT MEM_BACKING_STATIC
+#endif
+
+#ifndef MEM_HUGE_PAGE_SIZE
+#define MEM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+#ifndef MEM1_BACKING
+#define MEM1_BACKING      MEM_BACKING_DEFAULT
+#endif
+#ifndef MEM2_BACKING
+#define MEM2_BACKING      MEM_BACKING_DEFAULT
+#endif
+#ifndef MEM3_BACKING
+#define MEM3_BACKING      MEM_BACKING_DEFAULT
+#endif
+#ifndef MEM4_BACKING
+#define MEM4_BACKING      MEM_BACKING_DEFAULT
+#endif
+#ifndef MEM5_BACKING
+#define MEM5_BACKING      MEM_BACKING_DEFAULT
+#endif
+
+/* Elastic banks when CONFIG_MEMORY_POOL_ELASTIC is enabled: once the pool
+ * of a bank is exhausted, up to MEMn_CHUNKS extra chunks of the same
+ * geometry are mmap'd, each with its own table. A chunk that stayed fully
+ * free for MEM_CHUNK_IDLE_MS goes back to the OS, unmapped or only
+ * MADV_DONTNEED'd as MEM_CHUNK_RELEASE selects. MEMn_CHUNKS 0 keeps the
+ * bank fixed. Chunks take the POPULATE and LOCK flags of MEMn_BACKING,
+ * not its huge pages.
+ */
+#define MEM_CHUNK_UNMAP    0
+#define MEM_CHUNK_DONTNEED 1
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+#define MEM_CHUNKS_DEFAULT 4
+#else
+#define MEM_CHUNKS_DEFAULT 0
+#endif
+
+#ifndef MEM_CHUNK_MAX
+#define MEM_CHUNK_MAX      16
+#endif
+#ifndef MEM_CHUNK_IDLE_MS
+#define MEM_CHUNK_IDLE_MS  1000
+#endif
+#ifndef MEM_CHUNK_RELEASE
+#define MEM_CHUNK_RELEASE  MEM_CHUNK_UNMAP
+#endif
+
+#ifndef MEM1_CHUNKS
+#define MEM1_CHUNKS       MEM_CHUNKS_DEFAULT
+#endif
+#ifndef MEM2_CHUNKS
+#define MEM2_CHUNKS       MEM_CHUNKS_DEFAULT
+#endif
+#ifndef MEM3_CHUNKS
+#define MEM3_CHUNKS       MEM_CHUNKS_DEFAULT
+#endif
+#ifndef MEM4_CHUNKS
+#define MEM4_CHUNKS       MEM_CHUNKS_DEFAULT
+#endif
+#ifndef MEM5_CHUNKS
+#define MEM5_CHUNKS       MEM_CHUNKS_DEFAULT
+#endif
+
+/* log2 of a power of two block size, up to 64 KiB */
+#define MEM_BLOCK_SHIFT(size)                                               \
+    ((size) >= 0x10000 ? 16 : (size) >= 0x8000 ? 15 : (size) >= 0x4000 ? 14 \
+     : (size) >= 0x2000 ? 13 : (size) >= 0x1000 ? 12 : (size) >= 0x800 ? 11 \
+     : (size) >= 0x400 ? 10 : (size) >= 0x200 ? 9 : (size) >= 0x100 ? 8    \
+     : (size) >= 0x80 ? 7 : (size) >= 0x40 ? 6 : (size) >= 0x20 ? 5       \
+     : (size) >= 0x10 ? 4 : (size) >= 0x8 ? 3 : (size) >= 0x4 ? 2         \
+     : (size) >= 0x2 ? 1 : 0)
+
+#define MEM1_TABLE_SIZE   (MEM1_POOL_SIZE / MEM1_BLOCK_SIZE)
+#define MEM2_TABLE_SIZE   (MEM2_POOL_SIZE / MEM2_BLOCK_SIZE)
+#define MEM3_TABLE_SIZE   (MEM3_POOL_SIZE / MEM3_BLOCK_SIZE)
+#define MEM4_TABLE_SIZE   (MEM4_POOL_SIZE / MEM4_BLOCK_SIZE)
+#define MEM5_TABLE_SIZE   (MEM5_POOL_SIZE / MEM5_BLOCK_SIZE)
+
+#define MEM1_BLOCK_SHIFT  MEM_BLOCK_SHIFT(MEM1_BLOCK_SIZE)
+#define MEM2_BLOCK_SHIFT  MEM_BLOCK_SHIFT(MEM2_BLOCK_SIZE)
+#define MEM3_BLOCK_SHIFT  MEM_BLOCK_SHIFT(MEM3_BLOCK_SIZE)
+#define MEM4_BLOCK_SHIFT  MEM_BLOCK_SHIFT(MEM4_BLOCK_SIZE)
+#define MEM5_BLOCK_SHIFT  MEM_BLOCK_SHIFT(MEM5_BLOCK_SIZE)
+
+#endif /* _MEM_CONFIG_H_ */
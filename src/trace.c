@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "malloc.h"
+
+#ifndef TRACE_RING_NUM
+#define TRACE_RING_NUM  (4096)  /* records per thread ring, power of two */
+#endif
+#define TRACE_SITE_NUM  (64)    /* file name hash cache, power of two */
+#define TRACE_WRITE_NUM (256)   /* records per fwrite */
+
+#ifndef TRACE_FLUSH_MS
+#define TRACE_FLUSH_MS  (100)   /* writer thread period */
+#endif
+
+#if TRACE_RING_NUM & (TRACE_RING_NUM - 1)
+#error "TRACE_RING_NUM error"
+#endif
+
+#if TRACE_SITE_NUM & (TRACE_SITE_NUM - 1)
+#error "TRACE_SITE_NUM error"
+#endif
+
+typedef struct {
+    const char* file_name;
+    uint32_t    hash;
+} trace_site_t;
+
+/* ring entry, the site hash is only computed when the ring is drained */
+typedef struct {
+    memory_pool_trace_record_t rec;
+    const char*                file_name;
+} trace_entry_t;
+
+/* Single producer ring of one thread, drained by the writer thread every
+ * TRACE_FLUSH_MS or once the ring is half full. The ring outlives its
+ * thread and is handed to the next new thread.
+ */
+typedef struct trace_ring {
+    struct trace_ring* p_next;
+    _Atomic uint32_t   head;   /* moved by the owning thread */
+    _Atomic uint32_t   tail;   /* moved by the drain */
+    atomic_bool        owned;
+    uint16_t           thread;
+    trace_entry_t      entry[TRACE_RING_NUM];
+} trace_ring_t;
+
+static _Atomic(trace_ring_t*) trace_rings      = NULL;
+static atomic_uint            trace_thread_cnt = 0;
+static atomic_uint            trace_dropped    = 0;
+static atomic_bool            trace_enabled    = false;
+
+static _Thread_local trace_ring_t* trace_local = NULL;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  trace_key;
+
+/* drain side, only touched with the trace lock held */
+static trace_site_t               trace_site[TRACE_SITE_NUM];
+static memory_pool_trace_record_t trace_write[TRACE_WRITE_NUM];
+static FILE*                      trace_fp = NULL;
+static uint32_t                   trace_dropped_logged = 0;
+static pthread_t                  trace_writer_tid;
+static bool                       trace_writer_run = false;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static sem_t           trace_wake;   /* posted by a half full ring */
+
+static uint64_t trace_timestamp(void)
+{
+    /* the cross-thread ordering key of replay, served from the vDSO */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t trace_site_hash(const char* file_name)
+{
+    if (file_name == NULL) {
+        return 0;
+    }
+
+    /* __FILE__ strings are stable, so cache the hash by pointer */
+    uint32_t slot = ((uintptr_t)file_name >> 3) & (TRACE_SITE_NUM - 1);
+    if (trace_site[slot].file_name == file_name) {
+        return trace_site[slot].hash;
+    }
+
+    const char* name = strrchr(file_name, '/');
+    name             = name ? (name + 1) : file_name;
+
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+
+    trace_site[slot].file_name = file_name;
+    trace_site[slot].hash      = hash;
+    return hash;
+}
+
+static void trace_ring_release(void* arg)
+{
+    trace_ring_t* p_ring = arg;
+    atomic_store_explicit(&p_ring->owned, false, memory_order_release);
+}
+
+/* a late producer may still post, so the semaphore lives for good */
+static void trace_once_init(void)
+{
+    pthread_key_create(&trace_key, trace_ring_release);
+    sem_init(&trace_wake, 0, 0);
+}
+
+/* ring of the calling thread, reusing one of an exited thread if any */
+static trace_ring_t* trace_ring_get(void)
+{
+    if (trace_local) {
+        return trace_local;
+    }
+
+    pthread_once(&trace_once, trace_once_init);
+
+    trace_ring_t* p_ring = atomic_load_explicit(&trace_rings,
+                                                memory_order_acquire);
+    for (; p_ring; p_ring = p_ring->p_next) {
+        bool owned = false;
+        if (atomic_compare_exchange_strong_explicit(
+                &p_ring->owned, &owned, true, memory_order_acq_rel,
+                memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    if (p_ring == NULL) {
+        p_ring = calloc(1, sizeof(trace_ring_t));
+        if (p_ring == NULL) {
+            return NULL;
+        }
+
+        atomic_init(&p_ring->owned, true);
+        p_ring->thread = atomic_fetch_add(&trace_thread_cnt, 1) + 1;
+        p_ring->p_next = atomic_load_explicit(&trace_rings,
+                                              memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(
+            &trace_rings, &p_ring->p_next, p_ring, memory_order_release,
+            memory_order_relaxed)) {
+        }
+    }
+
+    pthread_setspecific(trace_key, p_ring);
+    trace_local = p_ring;
+    return p_ring;
+}
+
+/* lock-free, a record is dropped if the ring of the thread is full */
+static void trace_append(uint8_t op, uint8_t memx, uint32_t size,
+                         uint32_t object, char* file_name, uint32_t func_line)
+{
+    trace_ring_t* p_ring = trace_ring_get();
+    if (p_ring == NULL) {
+        atomic_fetch_add_explicit(&trace_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    uint32_t head = atomic_load_explicit(&p_ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&p_ring->tail, memory_order_acquire);
+    if ((head - tail) == TRACE_RING_NUM) {
+        atomic_fetch_add_explicit(&trace_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    trace_entry_t* p_entry = &p_ring->entry[head & (TRACE_RING_NUM - 1)];
+
+    p_entry->rec.timestamp = trace_timestamp();
+    p_entry->rec.object    = object;
+    p_entry->rec.size      = size;
+    p_entry->rec.line      = func_line;
+    p_entry->rec.thread    = p_ring->thread;
+    p_entry->rec.memx      = memx;
+    p_entry->rec.op        = op;
+    p_entry->file_name     = file_name;
+
+    atomic_store_explicit(&p_ring->head, head + 1, memory_order_release);
+
+    if ((head - tail) == (TRACE_RING_NUM / 2)) {
+        sem_post(&trace_wake);
+    }
+}
+
+/* move every ring into the file, must be called with the trace lock held,
+ * without a file the records are discarded
+ */
+static void trace_drain_locked(void)
+{
+    uint32_t count = 0;
+
+    trace_ring_t* p_ring = atomic_load_explicit(&trace_rings,
+                                                memory_order_acquire);
+    for (; p_ring; p_ring = p_ring->p_next) {
+        uint32_t tail = atomic_load_explicit(&p_ring->tail,
+                                             memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&p_ring->head,
+                                             memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            trace_entry_t* p_entry
+                = &p_ring->entry[tail & (TRACE_RING_NUM - 1)];
+
+            if (trace_fp) {
+                trace_write[count]      = p_entry->rec;
+                trace_write[count].site = trace_site_hash(p_entry->file_name);
+                if (++count == TRACE_WRITE_NUM) {
+                    fwrite(trace_write, sizeof(memory_pool_trace_record_t),
+                           count, trace_fp);
+                    count = 0;
+                }
+            }
+        }
+
+        atomic_store_explicit(&p_ring->tail, tail, memory_order_release);
+    }
+
+    /* tell readers how many records are missing since the last marker */
+    uint32_t dropped = atomic_load_explicit(&trace_dropped,
+                                            memory_order_relaxed);
+    if (trace_fp && (dropped != trace_dropped_logged)) {
+        memory_pool_trace_record_t* p_rec = &trace_write[count++];
+
+        memset(p_rec, 0, sizeof(*p_rec));
+        p_rec->timestamp     = trace_timestamp();
+        p_rec->object        = MEMORY_POOL_TRACE_NO_OBJECT;
+        p_rec->size          = dropped - trace_dropped_logged;
+        p_rec->memx          = MEMORY_POOL_TRACE_NO_BANK;
+        p_rec->op            = MEMORY_POOL_TRACE_DROP;
+        trace_dropped_logged = dropped;
+    }
+
+    if (trace_fp && count) {
+        fwrite(trace_write, sizeof(memory_pool_trace_record_t), count,
+               trace_fp);
+    }
+}
+
+static void* trace_writer(void* arg)
+{
+    UNUSED(arg);
+
+    pthread_mutex_lock(&mutex);
+    while (trace_writer_run) {
+        pthread_mutex_unlock(&mutex);
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (TRACE_FLUSH_MS % 1000) * 1000000l;
+        ts.tv_sec  += TRACE_FLUSH_MS / 1000 + ts.tv_nsec / 1000000000l;
+        ts.tv_nsec %= 1000000000l;
+        sem_timedwait(&trace_wake, &ts);
+
+        pthread_mutex_lock(&mutex);
+        trace_drain_locked();
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return NULL;
+}
+
+bool memory_pool_trace_start(const char* path)
+{
+    memory_pool_trace_header_t header = {
+        .magic       = MEMORY_POOL_TRACE_MAGIC,
+        .version     = MEMORY_POOL_TRACE_VERSION,
+        .record_size = sizeof(memory_pool_trace_record_t),
+        .bank_count  = SRAMBANK,
+    };
+
+    pthread_mutex_lock(&mutex);
+
+    if (trace_fp) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+
+    /* drop what threads still appended after the last stop */
+    trace_drain_locked();
+
+    trace_fp = fopen(path, "wb");
+    if (trace_fp == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, trace_fp) != 1) {
+        fclose(trace_fp);
+        trace_fp = NULL;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+
+    pthread_once(&trace_once, trace_once_init);
+
+    trace_writer_run = true;
+    if (pthread_create(&trace_writer_tid, NULL, trace_writer, NULL) != 0) {
+        trace_writer_run = false;
+        fclose(trace_fp);
+        trace_fp = NULL;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+
+    atomic_store(&trace_dropped, 0);
+    trace_dropped_logged = 0;
+    atomic_store(&trace_enabled, true);
+
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+void memory_pool_trace_flush(void)
+{
+    pthread_mutex_lock(&mutex);
+    trace_drain_locked();
+    if (trace_fp) {
+        fflush(trace_fp);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void memory_pool_trace_stop(void)
+{
+    atomic_store(&trace_enabled, false);
+
+    pthread_mutex_lock(&mutex);
+    bool join        = trace_writer_run;
+    trace_writer_run = false;
+    pthread_mutex_unlock(&mutex);
+
+    if (join) {
+        sem_post(&trace_wake);
+        pthread_join(trace_writer_tid, NULL);
+    }
+
+    pthread_mutex_lock(&mutex);
+    trace_drain_locked();
+    if (trace_fp) {
+        fclose(trace_fp);
+        trace_fp = NULL;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+uint32_t memory_pool_trace_dropped(void)
+{
+    return atomic_load(&trace_dropped);
+}
+
+void memory_pool_trace_malloc(uint8_t op, uint8_t memx, uint32_t size,
+                              uint32_t object, char* file_name,
+                              uint32_t func_line)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+
+    trace_append(op, memx, size, object, file_name, func_line);
+}
+
+void memory_pool_trace_free(uint8_t memx, uint32_t object, char* file_name,
+                            uint32_t func_line)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+
+    trace_append(MEMORY_POOL_TRACE_FREE, memx, 0, object, file_name,
+                 func_line);
+}
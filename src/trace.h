@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef __PACKED
+#define __PACKED __attribute__((packed))
+#endif
+
+/* Binary trace file: one header followed by records. Every thread records
+ * into its own lock-free ring, which a writer thread appends to the file,
+ * so records are only ordered per thread and readers sort them by
+ * timestamp. A block is identified by its bank and pool offset, which is
+ * unique while the block is live, so replay can pair every free with its
+ * allocation without storing pointers. Records lost to a full ring are
+ * counted by a MEMORY_POOL_TRACE_DROP marker written when the rings are
+ * drained.
+ */
+#define MEMORY_POOL_TRACE_MAGIC   0x5254504d  /* "MPTR" */
+#define MEMORY_POOL_TRACE_VERSION 1
+
+#define MEMORY_POOL_TRACE_MALLOC  0x01
+#define MEMORY_POOL_TRACE_CALLOC  0x02
+#define MEMORY_POOL_TRACE_FREE    0x03
+#define MEMORY_POOL_TRACE_DROP    0x04  /* size records lost since the last */
+
+#define MEMORY_POOL_TRACE_NO_BANK   0xff  /* memx of a drop marker */
+
+#define MEMORY_POOL_TRACE_NO_OBJECT 0xffffffff  /* allocation failed */
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint8_t  bank_count;
+    uint8_t  reserved[7];
+} __PACKED memory_pool_trace_header_t;
+
+typedef struct {
+    uint64_t timestamp;  /* CLOCK_MONOTONIC nanoseconds */
+    uint32_t object;     /* pool offset of the block */
+    uint32_t size;       /* requested bytes, 0 for free */
+    uint32_t site;       /* FNV-1a hash of the call site file name */
+    uint32_t line;       /* call site line */
+    uint16_t thread;     /* recording thread, numbered from 1 */
+    uint8_t  memx;
+    uint8_t  op;         /* MEMORY_POOL_TRACE_xxx */
+} __PACKED memory_pool_trace_record_t;
+
+/* start recording into path, a writer thread drains the per-thread rings
+ * every TRACE_FLUSH_MS or as soon as one of them is half full
+ */
+bool memory_pool_trace_start(const char* path);
+
+/* drain the per-thread rings into the file right away */
+void memory_pool_trace_flush(void);
+
+/* flush and close the trace file */
+void memory_pool_trace_stop(void);
+
+/* records lost because the ring of their thread was full, also written
+ * into the file as MEMORY_POOL_TRACE_DROP markers
+ */
+uint32_t memory_pool_trace_dropped(void);
+
+void memory_pool_trace_malloc(uint8_t op, uint8_t memx, uint32_t size,
+                              uint32_t object, char* file_name,
+                              uint32_t func_line);
+
+void memory_pool_trace_free(uint8_t memx, uint32_t object, char* file_name,
+                            uint32_t func_line);
+
+#endif /* _TRACE_H_ */
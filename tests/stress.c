@@ -0,0 +1,606 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/* Stress and correctness test of the allocator paths.
+ *
+ *   mempool_stress [-t threads] [-n iterations] [-s seed]
+ *
+ * Phase 1 hammers every bank from many threads with random sizes, zeroed
+ * allocations and frees handed over to other threads, and checks that no
+ * two live blocks overlap. Banks of type MEM_TYPE_RING_SPSC only allow one
+ * allocating and one freeing thread, so phase 2 runs a producer and a
+ * consumer thread on each of them instead. Phase 3 runs double frees, also
+ * from a foreign thread into an owned bank, and frees of foreign pointers.
+ * Phase 4, with buffers enabled, hands reference-counted buffers and
+ * slices of them between threads until the last reference frees them. The
+ * bank tables, block counters and the debug tracer lists are checked after
+ * every phase. With the trace recorder enabled, all phases are traced.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "malloc.h"
+
+#if CONFIG_MEMORY_POOL_DEBUG
+#include "debug.h"
+#endif
+
+#if CONFIG_MEMORY_POOL_BUFFER
+#include "buffer.h"
+#endif
+
+#if CONFIG_MEMORY_POOL_TRACE
+#include "trace.h"
+#endif
+
+#define STRESS_THREAD_NUM   (8)
+#define STRESS_SLOT_NUM     (64)   /* live blocks per thread */
+#define STRESS_EXCHANGE_NUM (128)  /* blocks handed between threads */
+#define STRESS_SIZE_MAX     (2048)
+#define STRESS_SLICE_BURST  (300)  /* more slices than static descriptors */
+#define STRESS_SPSC_NUM     (64)   /* records in flight, power of two */
+#define STRESS_TRACE_FILE   "mempool_stress.trace"
+
+/* head of every test block, the rest of the block is filled with tag */
+typedef struct {
+    uint32_t size;
+    uint8_t  memx;
+    uint8_t  tag;
+} stress_block_t;
+
+static _Atomic(stress_block_t*) exchange[STRESS_EXCHANGE_NUM];
+#if CONFIG_MEMORY_POOL_BUFFER
+static _Atomic(mem_buf_t*)      buf_exchange[STRESS_EXCHANGE_NUM];
+#endif
+static atomic_uint              failures = 0;
+
+/* records handed from the producer to the consumer of an SPSC bank */
+static stress_block_t*  spsc_queue[STRESS_SPSC_NUM];
+static _Atomic uint32_t spsc_head = 0;
+static _Atomic uint32_t spsc_tail = 0;
+
+static uint32_t iterations = 20000;
+static uint32_t threads    = STRESS_THREAD_NUM;
+static uint32_t seed       = 1;
+
+static bool     bank_used[SRAMBANK];
+static bool     bank_spsc[SRAMBANK];
+static uint32_t bank_size_max[SRAMBANK];
+
+#define STRESS_CHECK(cond, ...)                                              \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                      \
+            printf(__VA_ARGS__);                                             \
+            printf("\n");                                                    \
+            atomic_fetch_add(&failures, 1);                                  \
+        }                                                                    \
+    } while (0)
+
+static uint32_t stress_rand(uint32_t* state)
+{
+    /* xorshift32 */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static stress_block_t* stress_alloc_bank(uint32_t* state, uint8_t memx,
+                                         uint8_t tag)
+{
+    uint32_t size = sizeof(stress_block_t)
+                    + stress_rand(state) % (bank_size_max[memx]
+                                            - sizeof(stress_block_t) + 1);
+
+    bool            zero = (stress_rand(state) % 8) == 0;
+    stress_block_t* p_block
+        = zero ? MYCALLOC(memx, 1, size) : MYMALLOC(memx, size);
+    if (p_block == NULL) {
+        return NULL;
+    }
+
+    if (zero) {
+        const uint8_t* p_byte = (const uint8_t*)p_block;
+        for (uint32_t i = 0; i < size; i++) {
+            if (p_byte[i]) {
+                STRESS_CHECK(false, "%s calloc byte %u of %u is 0x%02x",
+                             mem_name(memx), i, size, p_byte[i]);
+                break;
+            }
+        }
+    }
+
+    p_block->size = size;
+    p_block->memx = memx;
+    p_block->tag  = tag;
+    memset(p_block + 1, tag, size - sizeof(stress_block_t));
+
+    return p_block;
+}
+
+static stress_block_t* stress_alloc(uint32_t* state, uint8_t tag)
+{
+    uint8_t memx;
+    do {
+        memx = stress_rand(state) % SRAMBANK;
+    } while (!bank_used[memx]);
+
+    return stress_alloc_bank(state, memx, tag);
+}
+
+/* a block still holding its tag was not handed out twice meanwhile */
+static void stress_free(stress_block_t* p_block)
+{
+    const uint8_t* p_byte = (const uint8_t*)(p_block + 1);
+    for (uint32_t i = 0; i < (p_block->size - sizeof(stress_block_t)); i++) {
+        if (p_byte[i] != p_block->tag) {
+            STRESS_CHECK(false, "%s block %p of %u bytes overwritten at %u",
+                         mem_name(p_block->memx), (void*)p_block,
+                         p_block->size, i);
+            break;
+        }
+    }
+
+    MYFREE(p_block);
+}
+
+static void* stress_thread(void* arg)
+{
+    uint32_t        id    = (uint32_t)(uintptr_t)arg;
+    uint32_t        state = seed * 2654435761u + id + 1;
+    stress_block_t* slot[STRESS_SLOT_NUM] = { NULL };
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    /* frees of the other threads go through the remote free queue */
+    if ((id < SRAMBANK) && bank_used[id]) {
+        mem_set_owner(id);
+    }
+#endif
+
+    for (uint32_t n = 0; n < iterations; n++) {
+        uint32_t k = stress_rand(&state) % STRESS_SLOT_NUM;
+
+        if (slot[k]) {
+            if ((stress_rand(&state) % 4) == 0) {
+                /* hand the block over, free whatever another thread left */
+                uint32_t        e       = stress_rand(&state)
+                                          % STRESS_EXCHANGE_NUM;
+                stress_block_t* p_block = atomic_exchange(&exchange[e],
+                                                          slot[k]);
+                if (p_block) {
+                    stress_free(p_block);
+                }
+            } else {
+                stress_free(slot[k]);
+            }
+            slot[k] = NULL;
+        } else {
+            slot[k] = stress_alloc(&state, (uint8_t)(id * 31 + n));
+        }
+    }
+
+    for (uint32_t k = 0; k < STRESS_SLOT_NUM; k++) {
+        if (slot[k]) {
+            stress_free(slot[k]);
+        }
+    }
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    if ((id < SRAMBANK) && bank_used[id]) {
+        mem_clear_owner(id);
+    }
+#endif
+
+    return NULL;
+}
+
+/* every bank consistent, and empty if expected */
+static void stress_check(const char* phase, bool empty)
+{
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        STRESS_CHECK(mem_check(memx), "%s: %s table is corrupted", phase,
+                     mem_name(memx));
+
+        mem_info_t info;
+        STRESS_CHECK(mem_snapshot(memx, &info, NULL, 0), "%s: no snapshot",
+                     phase);
+        if (empty && (bank_used[memx] || bank_spsc[memx])) {
+            STRESS_CHECK(info.used_blocks == 0,
+                         "%s: %s still has %u used blocks", phase,
+                         mem_name(memx), info.used_blocks);
+        }
+    }
+
+#if CONFIG_MEMORY_POOL_DEBUG
+    STRESS_CHECK(memory_pool_debug_check(), "%s: tracer lists are corrupted",
+                 phase);
+
+    memory_pool_debug_stat_t stat;
+    memory_pool_debug_stat(&stat);
+    if (empty) {
+        STRESS_CHECK(stat.used_node_cnt == 0, "%s: tracer has %u used nodes",
+                     phase, stat.used_node_cnt);
+    }
+#endif
+}
+
+static void stress_threads(void)
+{
+    pthread_t tid[threads];
+
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_create(&tid[i], NULL, stress_thread, (void*)(uintptr_t)i);
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(tid[i], NULL);
+    }
+
+    for (uint32_t e = 0; e < STRESS_EXCHANGE_NUM; e++) {
+        stress_block_t* p_block = atomic_exchange(&exchange[e], NULL);
+        if (p_block) {
+            stress_free(p_block);
+        }
+    }
+}
+
+/* allocate records in order, waiting for the consumer while the ring or
+ * the queue is full
+ */
+static void* stress_spsc_producer(void* arg)
+{
+    uint8_t  memx  = (uint8_t)(uintptr_t)arg;
+    uint32_t state = seed * 3266489917u + memx + 1;
+
+    for (uint32_t n = 0; n < iterations; n++) {
+        stress_block_t* p_block;
+        while ((p_block = stress_alloc_bank(&state, memx, (uint8_t)n))
+               == NULL) {
+            sched_yield();
+        }
+
+        uint32_t head = atomic_load_explicit(&spsc_head, memory_order_relaxed);
+        while ((head - atomic_load_explicit(&spsc_tail, memory_order_acquire))
+               == STRESS_SPSC_NUM) {
+            sched_yield();
+        }
+
+        spsc_queue[head & (STRESS_SPSC_NUM - 1)] = p_block;
+        atomic_store_explicit(&spsc_head, head + 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+/* free the records in the order they were allocated */
+static void* stress_spsc_consumer(void* arg)
+{
+    UNUSED(arg);
+
+    for (uint32_t n = 0; n < iterations; n++) {
+        uint32_t tail = atomic_load_explicit(&spsc_tail, memory_order_relaxed);
+        while (atomic_load_explicit(&spsc_head, memory_order_acquire) == tail) {
+            sched_yield();
+        }
+
+        stress_block_t* p_block = spsc_queue[tail & (STRESS_SPSC_NUM - 1)];
+        atomic_store_explicit(&spsc_tail, tail + 1, memory_order_release);
+
+        STRESS_CHECK(p_block->tag == (uint8_t)n,
+                     "%s record %u came out of order", mem_name(p_block->memx),
+                     n);
+        stress_free(p_block);
+    }
+
+    return NULL;
+}
+
+static void stress_spsc(void)
+{
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        if (!bank_spsc[memx]) {
+            continue;
+        }
+
+        pthread_t producer, consumer;
+        pthread_create(&producer, NULL, stress_spsc_producer,
+                       (void*)(uintptr_t)memx);
+        pthread_create(&consumer, NULL, stress_spsc_consumer, NULL);
+        pthread_join(producer, NULL);
+        pthread_join(consumer, NULL);
+    }
+}
+
+#if CONFIG_MEMORY_POOL_BUFFER
+/* a buffer payload is filled with one tag, so every slice of it is too */
+static void stress_buf_put(mem_buf_t* buf)
+{
+    for (uint32_t i = 1; i < buf->len; i++) {
+        if (buf->data[i] != buf->data[0]) {
+            STRESS_CHECK(false, "%s buffer %p of %u bytes overwritten at %u",
+                         mem_name(buf->memx), (void*)buf, buf->len, i);
+            break;
+        }
+    }
+
+    mem_buf_release(buf);
+}
+
+/* hand a reference to another thread, drop the one left there */
+static void stress_buf_swap(uint32_t* state, mem_buf_t* buf)
+{
+    if (buf == NULL) {
+        return;
+    }
+
+    uint32_t   e    = stress_rand(state) % STRESS_EXCHANGE_NUM;
+    mem_buf_t* prev = atomic_exchange(&buf_exchange[e], buf);
+    if (prev) {
+        stress_buf_put(prev);
+    }
+}
+
+static void* stress_buf_thread(void* arg)
+{
+    uint32_t id    = (uint32_t)(uintptr_t)arg;
+    uint32_t state = seed * 2246822519u + id + 1;
+
+    for (uint32_t n = 0; n < (iterations / 4); n++) {
+        uint8_t memx = stress_rand(&state) % SRAMBANK;
+        if (!bank_used[memx]
+            || (bank_size_max[memx] <= sizeof(mem_buf_t))) {
+            continue;
+        }
+
+        uint32_t   size = 1 + stress_rand(&state)
+                                  % (bank_size_max[memx] - sizeof(mem_buf_t));
+        mem_buf_t* buf  = MEM_BUF_ALLOC(memx, size);
+        if (buf == NULL) {
+            continue;
+        }
+        memset(buf->data, (uint8_t)(id * 31 + n), size);
+
+        uint32_t   offset = stress_rand(&state) % size;
+        mem_buf_t* slice  = mem_buf_slice(
+            buf, offset, 1 + stress_rand(&state) % (size - offset));
+        mem_buf_t* sub    = slice ? mem_buf_slice(slice, 0, 1) : NULL;
+
+        if ((stress_rand(&state) % 256) == 0) {
+            /* run out of static descriptors, the rest take bank blocks */
+            mem_buf_t* burst[STRESS_SLICE_BURST];
+            for (uint32_t i = 0; i < STRESS_SLICE_BURST; i++) {
+                burst[i] = mem_buf_slice(buf, 0, size);
+            }
+            for (uint32_t i = 0; i < STRESS_SLICE_BURST; i++) {
+                if (burst[i]) {
+                    stress_buf_put(burst[i]);
+                }
+            }
+        }
+
+        stress_buf_swap(&state, slice);
+        stress_buf_swap(&state, sub);
+        stress_buf_swap(&state, mem_buf_retain(buf));
+        stress_buf_put(buf);
+    }
+
+    return NULL;
+}
+
+static void stress_buffers(void)
+{
+    pthread_t tid[threads];
+
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_create(&tid[i], NULL, stress_buf_thread, (void*)(uintptr_t)i);
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(tid[i], NULL);
+    }
+
+    for (uint32_t e = 0; e < STRESS_EXCHANGE_NUM; e++) {
+        mem_buf_t* buf = atomic_exchange(&buf_exchange[e], NULL);
+        if (buf) {
+            stress_buf_put(buf);
+        }
+    }
+}
+#endif
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+static void* stress_remote_free(void* arg)
+{
+    MYFREE(arg);
+    MYFREE(arg);
+    return NULL;
+}
+#endif
+
+static void stress_misuse(void)
+{
+    uint32_t state = seed;
+
+    /* double free, the second one must not release anything */
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        if (!bank_used[memx]) {
+            continue;
+        }
+
+        stress_block_t* p_keep  = stress_alloc(&state, 0x5a);
+        stress_block_t* p_block = MYMALLOC(memx, sizeof(stress_block_t));
+        if (p_block == NULL) {
+            stress_free(p_keep);
+            continue;
+        }
+
+        MYFREE(p_block);
+        MYFREE(p_block);
+        STRESS_CHECK(mem_check(memx), "%s double free broke the table",
+                     mem_name(memx));
+
+        if (p_keep) {
+            stress_free(p_keep);
+        }
+    }
+
+#if CONFIG_MEMORY_POOL_REMOTE_FREE
+    /* remote double free of a block whose payload looks like a queue link,
+     * it must be released exactly once
+     */
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        if (!bank_used[memx]) {
+            continue;
+        }
+
+        mem_set_owner(memx);
+
+        uint32_t* p_words = MYMALLOC(memx, 4 * sizeof(uint32_t));
+        if (p_words) {
+            p_words[0] = 0;
+            p_words[1] = 0;
+            p_words[2] = 0x52465245;
+            p_words[3] = 0x52465245;
+
+            pthread_t tid;
+            pthread_create(&tid, NULL, stress_remote_free, p_words);
+            pthread_join(tid, NULL);
+
+            mem_drain(memx);
+            STRESS_CHECK(mem_check(memx),
+                         "%s remote double free broke the table",
+                         mem_name(memx));
+        }
+
+        mem_clear_owner(memx);
+    }
+#endif
+
+#if CONFIG_MEMORY_POOL_ELASTIC
+    /* a request larger than the pool can not fit a chunk either */
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        mem_info_t info;
+        mem_snapshot(memx, &info, NULL, 0);
+
+        void* ptr = MYMALLOC(memx, info.pool_size + 1);
+        STRESS_CHECK(ptr == NULL, "%s handed out %u bytes", mem_name(memx),
+                     info.pool_size + 1);
+
+        uint32_t chunks = info.chunks;
+        mem_snapshot(memx, &info, NULL, 0);
+        STRESS_CHECK(info.chunks == chunks,
+                     "%s mapped a chunk for an oversized request",
+                     mem_name(memx));
+    }
+#endif
+
+    /* pointers the pools never handed out */
+    uint8_t  stack_byte = 0;
+    uint8_t* p_heap     = malloc(64);
+    void*    foreign[]  = { NULL, &stack_byte, p_heap, p_heap + 63,
+                            (void*)(uintptr_t)1, &failures };
+
+    for (uint32_t i = 0; i < (sizeof(foreign) / sizeof(foreign[0])); i++) {
+        MYFREE(foreign[i]);
+    }
+    free(p_heap);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:s:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printf("usage: %s [-t threads] [-n iterations] [-s seed]\n",
+                   argv[0]);
+            return 2;
+        }
+    }
+
+    if ((threads == 0) || (seed == 0)) {
+        printf("threads and seed must not be 0\n");
+        return 2;
+    }
+
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        mymem_init(memx);
+
+        mem_info_t info;
+        mem_snapshot(memx, &info, NULL, 0);
+
+        bank_size_max[memx] = info.pool_size / 8;
+        if (bank_size_max[memx] > STRESS_SIZE_MAX) {
+            bank_size_max[memx] = STRESS_SIZE_MAX;
+        }
+        if (bank_size_max[memx] < sizeof(stress_block_t)) {
+            bank_size_max[memx] = info.block_size;
+        }
+
+        bank_spsc[memx] = (info.type == MEM_TYPE_RING_SPSC)
+                          && (info.pool_size >= sizeof(stress_block_t));
+        bank_used[memx] = (info.type != MEM_TYPE_RING_SPSC)
+                          && (info.pool_size >= sizeof(stress_block_t));
+    }
+
+#if CONFIG_MEMORY_POOL_TRACE
+    STRESS_CHECK(memory_pool_trace_start(STRESS_TRACE_FILE),
+                 "can not trace into %s", STRESS_TRACE_FILE);
+#endif
+
+    stress_check("init", true);
+
+    stress_threads();
+    stress_check("threads", true);
+
+    stress_spsc();
+    stress_check("spsc", true);
+
+    stress_misuse();
+    stress_check("misuse", true);
+
+#if CONFIG_MEMORY_POOL_BUFFER
+    stress_buffers();
+    stress_check("buffers", true);
+#endif
+
+#if CONFIG_MEMORY_POOL_TRACE
+    memory_pool_trace_stop();
+    unlink(STRESS_TRACE_FILE);
+#endif
+
+    uint32_t count = atomic_load(&failures);
+    printf("%u threads x %u iterations, seed %u: %s\n", threads, iterations,
+           seed, count ? "FAILED" : "passed");
+
+    return count ? 1 : 0;
+}
@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2022 Junbo Zheng. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/* Replay a trace recorded with CONFIG_MEMORY_POOL_TRACE against the pool
+ * configuration this tool is built with, and report throughput, peak
+ * usage, failures and fragmentation.
+ *
+ *   mempool_replay [-t threads] [-p top|first|next|best] [-s samples] trace
+ *
+ * With more than one thread, recorded thread n is replayed by worker
+ * n % threads. A free waits until its allocation has been replayed, which
+ * never deadlocks since it only ever waits on an earlier record.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "malloc.h"
+#include "trace.h"
+
+#define REPLAY_NO_SLOT   0xffffffff
+#define REPLAY_FAILED    ((void*)1)
+#define REPLAY_MAX_THREAD 64
+
+typedef struct {
+    uint64_t key;   /* memx << 32 | object, 0 if empty */
+    uint32_t slot;
+} replay_map_t;
+
+typedef struct {
+    uint64_t peak_bytes;
+    uint32_t peak_blocks;
+    uint32_t samples;
+    double   frag_max;
+    double   frag_sum;
+} replay_bank_t;
+
+static memory_pool_trace_record_t* records    = NULL;
+static uint32_t*                   rec_slot   = NULL;
+static uint32_t                    record_cnt = 0;
+static uint64_t                    drop_cnt   = 0;
+static _Atomic(void*)*             objects    = NULL;
+static uint32_t*                   obj_size   = NULL;
+static uint32_t                    thread_cnt = 1;
+static uint32_t                    sample_ops = 4096;
+
+static atomic_uint_fast64_t ops_cnt      = 0;
+static atomic_uint_fast64_t fail_cnt     = 0;
+static atomic_uint_fast64_t skip_cnt     = 0;
+static atomic_uint_fast64_t trace_failed = 0;
+static atomic_uint_fast64_t live_bytes[SRAMBANK];
+
+static const char* const policy_name[] = { "top", "first", "next", "best" };
+
+static replay_bank_t   bank_stat[SRAMBANK];
+static pthread_mutex_t stat_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t replay_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Threads record into their own rings, so the file is only ordered per
+ * thread. A stable merge by timestamp restores the global order and keeps
+ * records of one thread with the same timestamp in file order.
+ */
+static bool replay_sort(void)
+{
+    memory_pool_trace_record_t* tmp
+        = malloc((record_cnt ? record_cnt : 1) * sizeof(*tmp));
+    if (tmp == NULL) {
+        return false;
+    }
+
+    memory_pool_trace_record_t* src = records;
+    memory_pool_trace_record_t* dst = tmp;
+    for (uint32_t width = 1; width < record_cnt; width *= 2) {
+        for (uint32_t lo = 0; lo < record_cnt; lo += 2 * width) {
+            uint32_t mid = lo + width;
+            uint32_t hi  = mid + width;
+            mid          = (mid > record_cnt) ? record_cnt : mid;
+            hi           = (hi > record_cnt) ? record_cnt : hi;
+
+            uint32_t i = lo, j = mid, k = lo;
+            while ((i < mid) && (j < hi)) {
+                dst[k++] = (src[j].timestamp < src[i].timestamp) ? src[j++]
+                                                                 : src[i++];
+            }
+            while (i < mid) {
+                dst[k++] = src[i++];
+            }
+            while (j < hi) {
+                dst[k++] = src[j++];
+            }
+        }
+
+        memory_pool_trace_record_t* swap = src;
+        src                              = dst;
+        dst                              = swap;
+    }
+
+    if (src != records) {
+        memcpy(records, src, record_cnt * sizeof(*tmp));
+    }
+
+    free(tmp);
+    return true;
+}
+
+static bool replay_load(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return false;
+    }
+
+    memory_pool_trace_header_t header;
+    if ((fread(&header, sizeof(header), 1, fp) != 1)
+        || (header.magic != MEMORY_POOL_TRACE_MAGIC)
+        || (header.version != MEMORY_POOL_TRACE_VERSION)
+        || (header.record_size != sizeof(memory_pool_trace_record_t))) {
+        fprintf(stderr, "%s: not a memory pool trace\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    uint32_t capacity = 0;
+    memory_pool_trace_record_t rec;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.op == MEMORY_POOL_TRACE_DROP) {
+            /* not replayed, records lost while tracing */
+            drop_cnt += rec.size;
+            continue;
+        }
+
+        if (record_cnt == capacity) {
+            capacity = capacity ? (capacity * 2) : 4096;
+            records  = realloc(records, capacity * sizeof(rec));
+            if (records == NULL) {
+                fclose(fp);
+                return false;
+            }
+        }
+        records[record_cnt++] = rec;
+    }
+
+    fclose(fp);
+    return replay_sort();
+}
+
+/* pair every free with the allocation of the same live block */
+static bool replay_prepare(void)
+{
+    uint32_t map_size = 16;
+    while (map_size < (record_cnt * 2)) {
+        map_size <<= 1;
+    }
+
+    replay_map_t* map = calloc(map_size, sizeof(replay_map_t));
+    rec_slot          = calloc(record_cnt ? record_cnt : 1, sizeof(uint32_t));
+    obj_size          = calloc(record_cnt ? record_cnt : 1, sizeof(uint32_t));
+    objects = calloc(record_cnt ? record_cnt : 1, sizeof(_Atomic(void*)));
+    if ((map == NULL) || (rec_slot == NULL) || (obj_size == NULL)
+        || (objects == NULL)) {
+        free(map);
+        return false;
+    }
+
+    uint32_t slot_cnt = 0;
+    for (uint32_t i = 0; i < record_cnt; i++) {
+        memory_pool_trace_record_t* p_rec = &records[i];
+
+        rec_slot[i] = REPLAY_NO_SLOT;
+        if (p_rec->memx >= SRAMBANK) {
+            continue;
+        }
+
+        if (p_rec->object == MEMORY_POOL_TRACE_NO_OBJECT) {
+            /* failed allocation, replayed but never paired with a free */
+            rec_slot[i] = slot_cnt++;
+            continue;
+        }
+
+        uint64_t key  = ((uint64_t)(p_rec->memx + 1) << 32) | p_rec->object;
+        uint32_t hash = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32);
+        uint32_t pos  = hash & (map_size - 1);
+
+        /* linear probing, deleted entries are re-inserted behind */
+        while (map[pos].key && (map[pos].key != key)) {
+            pos = (pos + 1) & (map_size - 1);
+        }
+
+        if (p_rec->op == MEMORY_POOL_TRACE_FREE) {
+            if (map[pos].key != key) {
+                /* allocated ahead of the trace, or a double free */
+                continue;
+            }
+
+            rec_slot[i] = map[pos].slot;
+
+            map[pos].key = 0;
+            for (uint32_t next = (pos + 1) & (map_size - 1); map[next].key;
+                 next          = (next + 1) & (map_size - 1)) {
+                replay_map_t entry = map[next];
+                map[next].key      = 0;
+
+                uint32_t at = (uint32_t)((entry.key * 0x9e3779b97f4a7c15ull)
+                                         >> 32)
+                              & (map_size - 1);
+                while (map[at].key) {
+                    at = (at + 1) & (map_size - 1);
+                }
+                map[at] = entry;
+            }
+        } else {
+            map[pos].key         = key;
+            map[pos].slot        = slot_cnt;
+            obj_size[slot_cnt]   = p_rec->size;
+            rec_slot[i]          = slot_cnt++;
+        }
+    }
+
+    free(map);
+    return true;
+}
+
+static void replay_sample(void)
+{
+    pthread_mutex_lock(&stat_mutex);
+
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        mem_info_t info;
+        mem_snapshot(memx, &info, NULL, 0);
+
+        uint32_t free_blocks = info.block_count - info.used_blocks;
+        double   frag        = free_blocks
+                                   ? (1.0 - (double)info.largest_free_run
+                                                / free_blocks)
+                                   : 0.0;
+
+        replay_bank_t* p_bank = &bank_stat[memx];
+        if (info.used_blocks > p_bank->peak_blocks) {
+            p_bank->peak_blocks = info.used_blocks;
+        }
+        if (frag > p_bank->frag_max) {
+            p_bank->frag_max = frag;
+        }
+        p_bank->frag_sum += frag;
+        p_bank->samples++;
+    }
+
+    pthread_mutex_unlock(&stat_mutex);
+}
+
+static void replay_peak(uint8_t memx, uint64_t bytes)
+{
+    pthread_mutex_lock(&stat_mutex);
+    if (bytes > bank_stat[memx].peak_bytes) {
+        bank_stat[memx].peak_bytes = bytes;
+    }
+    pthread_mutex_unlock(&stat_mutex);
+}
+
+static void replay_one(uint32_t index)
+{
+    memory_pool_trace_record_t* p_rec = &records[index];
+    uint32_t                    slot  = rec_slot[index];
+
+    if (slot == REPLAY_NO_SLOT) {
+        atomic_fetch_add(&skip_cnt, 1);
+        return;
+    }
+
+    if (p_rec->op == MEMORY_POOL_TRACE_FREE) {
+        void* ptr;
+        while ((ptr = atomic_load_explicit(&objects[slot],
+                                           memory_order_acquire))
+               == NULL) {
+            sched_yield();
+        }
+
+        if (ptr != REPLAY_FAILED) {
+            MYFREE(ptr);
+            atomic_fetch_sub(&live_bytes[p_rec->memx], obj_size[slot]);
+        }
+    } else {
+        void* ptr = (p_rec->op == MEMORY_POOL_TRACE_CALLOC)
+                        ? MYCALLOC(p_rec->memx, 1, p_rec->size)
+                        : MYMALLOC(p_rec->memx, p_rec->size);
+
+        if (p_rec->object == MEMORY_POOL_TRACE_NO_OBJECT) {
+            atomic_fetch_add(&trace_failed, 1);
+            if (ptr) {
+                MYFREE(ptr);
+            } else {
+                atomic_fetch_add(&fail_cnt, 1);
+            }
+        } else if (ptr) {
+            uint64_t bytes
+                = atomic_fetch_add(&live_bytes[p_rec->memx], p_rec->size)
+                  + p_rec->size;
+            replay_peak(p_rec->memx, bytes);
+            atomic_store_explicit(&objects[slot], ptr, memory_order_release);
+        } else {
+            atomic_fetch_add(&fail_cnt, 1);
+            atomic_store_explicit(&objects[slot], REPLAY_FAILED,
+                                  memory_order_release);
+        }
+    }
+
+    if ((atomic_fetch_add(&ops_cnt, 1) + 1) % sample_ops == 0) {
+        replay_sample();
+    }
+}
+
+static void* replay_worker(void* arg)
+{
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+
+    for (uint32_t i = 0; i < record_cnt; i++) {
+        if ((thread_cnt > 1) && ((records[i].thread % thread_cnt) != id)) {
+            continue;
+        }
+        replay_one(i);
+    }
+
+    return NULL;
+}
+
+static int replay_policy(const char* name)
+{
+    for (uint8_t i = 0; i < (sizeof(policy_name) / sizeof(policy_name[0]));
+         i++) {
+        if (strcmp(name, policy_name[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t threads] [-p top|first|next|best] [-s samples] "
+            "trace\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    int policy = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:p:s:h")) != -1) {
+        switch (opt) {
+        case 't':
+            thread_cnt = atoi(optarg);
+            break;
+        case 'p':
+            policy = replay_policy(optarg);
+            if (policy < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            sample_ops = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((optind >= argc) || (thread_cnt == 0)
+        || (thread_cnt > REPLAY_MAX_THREAD) || (sample_ops == 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!replay_load(argv[optind]) || !replay_prepare()) {
+        return 1;
+    }
+
+    if (drop_cnt) {
+        fprintf(stderr,
+                "%s: %lu records were dropped while tracing, the replay is "
+                "incomplete\n",
+                argv[optind], (unsigned long)drop_cnt);
+    }
+
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        mymem_init(memx);
+        if (policy >= 0) {
+            mem_set_policy(memx, policy);
+        }
+    }
+
+    pthread_t thread[REPLAY_MAX_THREAD];
+    uint64_t  start = replay_now();
+
+    if (thread_cnt == 1) {
+        replay_worker(NULL);
+    } else {
+        for (uint32_t i = 0; i < thread_cnt; i++) {
+            pthread_create(&thread[i], NULL, replay_worker,
+                           (void*)(uintptr_t)i);
+        }
+        for (uint32_t i = 0; i < thread_cnt; i++) {
+            pthread_join(thread[i], NULL);
+        }
+    }
+
+    uint64_t elapsed = replay_now() - start;
+    uint64_t ops     = atomic_load(&ops_cnt);
+
+    replay_sample();
+
+    printf("records    : %u (skipped %lu, dropped in trace %lu)\n",
+           record_cnt, (unsigned long)atomic_load(&skip_cnt),
+           (unsigned long)drop_cnt);
+    printf("threads    : %u\n", thread_cnt);
+    printf("elapsed    : %.3f ms\n", elapsed / 1e6);
+    printf("throughput : %.0f ops/s\n",
+           elapsed ? (ops * 1e9 / elapsed) : 0.0);
+    printf("failures   : %lu (failed in trace %lu)\n",
+           (unsigned long)atomic_load(&fail_cnt),
+           (unsigned long)atomic_load(&trace_failed));
+
+    printf("%-8s %-6s %12s %12s %9s %9s\n", "bank", "policy", "peak_bytes",
+           "peak_blocks", "max_frag", "avg_frag");
+    for (uint8_t memx = 0; memx < SRAMBANK; memx++) {
+        replay_bank_t* p_bank = &bank_stat[memx];
+        printf("%-8s %-6s %12lu %12u %8.1f%% %8.1f%%\n", mem_name(memx),
+               policy_name[mem_get_policy(memx)],
+               (unsigned long)p_bank->peak_bytes, p_bank->peak_blocks,
+               p_bank->frag_max * 100,
+               p_bank->samples ? (p_bank->frag_sum * 100 / p_bank->samples)
+                               : 0.0);
+    }
+
+    free(records);
+    free(rec_slot);
+    free(obj_size);
+    free((void*)objects);
+    return 0;
+}